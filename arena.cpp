@@ -0,0 +1,80 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+void * Arena::allocate(size_t size, size_t alignment)
+{
+    size_t padding = (alignment - reinterpret_cast<uintptr_t>(position) % alignment) % alignment;
+
+    if (padding + size > available)
+    {
+        size_t new_block_size = std::max(block_size, size + alignment);
+        blocks.emplace_back(new char[new_block_size]);
+        if (blocks.size() == 1)
+            first_block_size = new_block_size;
+        position = blocks.back().get();
+        available = new_block_size;
+        padding = (alignment - reinterpret_cast<uintptr_t>(position) % alignment) % alignment;
+    }
+
+    void * result = position + padding;
+    position += padding + size;
+    available -= padding + size;
+    return result;
+}
+
+void Arena::clear()
+{
+    if (blocks.empty())
+        return;
+
+    blocks.resize(1);
+    position = blocks.front().get();
+    available = first_block_size;
+}
+
+string_view Arena::copy(string_view text)
+{
+    if (text.empty())
+        return string_view();
+
+    auto * data = static_cast<char*>(allocate(text.size(), 1));
+    memcpy(data, text.data(), text.size());
+    return string_view(data, text.size());
+}
+
+string_view NameTable::intern(string_view text)
+{
+    if (text.empty())
+        return string_view();
+
+    size_t hash = std::hash<string_view>()(text);
+    auto & shard = shards[hash % shard_count];
+    lock_guard<std::mutex> lock(shard.mutex);
+
+    auto found = shard.texts.find(text);
+    if (found != shard.texts.end())
+        return *found;
+
+    return *shard.texts.insert(shard.arena.copy(text)).first;
+}
+
+string_view NameTable::number(int value)
+{
+    auto & shard = shards[static_cast<unsigned>(value) % shard_count];
+    lock_guard<std::mutex> lock(shard.mutex);
+
+    auto & name = shard.numbers[value];
+    if (name.empty())
+    {
+        char buffer[16];
+        auto result = to_chars(buffer, buffer + sizeof(buffer), value);
+        name = shard.arena.copy(string_view(buffer, result.ptr - buffer));
+    }
+    return name;
+}
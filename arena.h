@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Allocates objects and text in large blocks, which are all released
+// together when the arena is destroyed. Objects are never destroyed
+// individually, so they must be trivially destructible.
+class Arena
+{
+public:
+    Arena() {}
+    Arena(const Arena &) = delete;
+    Arena & operator=(const Arena &) = delete;
+
+    template <typename T, typename ... Args>
+    T * make(Args && ... args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "Objects in an arena are never destroyed.");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    std::string_view copy(std::string_view text);
+
+    // Releases all objects at once, keeping the first block for reuse.
+    void clear();
+
+private:
+    void * allocate(size_t size, size_t alignment);
+
+    static constexpr size_t block_size = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char * position = nullptr;
+    size_t available = 0;
+    size_t first_block_size = 0;
+};
+
+// Stores each distinct text and number once, for any number of threads,
+// so that results refer to a single copy of each name not owned by descriptors.
+// Numbers are formatted once, when first used. Views are valid as long as the table.
+// Names are spread over shards by hash, so that threads seldom wait for each other.
+class NameTable
+{
+public:
+    NameTable() {}
+    NameTable(const NameTable &) = delete;
+    NameTable & operator=(const NameTable &) = delete;
+
+    std::string_view intern(std::string_view text);
+    // The decimal text of the value.
+    std::string_view number(int value);
+
+private:
+    struct Shard
+    {
+        std::mutex mutex;
+        Arena arena;
+        std::unordered_set<std::string_view> texts;
+        std::unordered_map<int, std::string_view> numbers;
+    };
+
+    static constexpr size_t shard_count = 16;
+
+    Shard shards[shard_count];
+};
+
+// Singly linked list of arena objects, linked through their 'next' member.
+template <typename T>
+class Chain
+{
+public:
+    template <typename U>
+    class Iterator
+    {
+    public:
+        Iterator(U * node = nullptr): node(node) {}
+        U & operator*() const { return *node; }
+        U * operator->() const { return node; }
+        Iterator & operator++() { node = node->next; return *this; }
+        bool operator==(const Iterator & other) const { return node == other.node; }
+        bool operator!=(const Iterator & other) const { return node != other.node; }
+
+    private:
+        U * node;
+    };
+
+    using iterator = Iterator<T>;
+    using const_iterator = Iterator<const T>;
+
+    iterator begin() { return iterator(first); }
+    iterator end() { return iterator(); }
+    const_iterator begin() const { return const_iterator(first); }
+    const_iterator end() const { return const_iterator(); }
+
+    bool empty() const { return !first; }
+    size_t size() const { return count; }
+
+    T & front() { return *first; }
+    T & back() { return *last; }
+    const T & front() const { return *first; }
+    const T & back() const { return *last; }
+
+    void push_back(T * node)
+    {
+        node->next = nullptr;
+        if (last)
+            last->next = node;
+        else
+            first = node;
+        last = node;
+        ++count;
+    }
+
+    // Inserts node after position, which must be in this chain,
+    // or at the front if position is null.
+    void insert_after(T * position, T * node)
+    {
+        if (!position)
+        {
+            node->next = first;
+            first = node;
+        }
+        else
+        {
+            node->next = position->next;
+            position->next = node;
+        }
+        if (!node->next)
+            last = node;
+        ++count;
+    }
+
+    // Inserts node before position, which must be in this chain.
+    void insert(T * position, T * node)
+    {
+        T ** link = &first;
+        while (*link != position)
+            link = &(*link)->next;
+        node->next = position;
+        *link = node;
+        ++count;
+    }
+
+    template <typename Predicate>
+    void remove_if(Predicate predicate)
+    {
+        T ** link = &first;
+        last = nullptr;
+        while (*link)
+        {
+            if (predicate(**link))
+            {
+                *link = (*link)->next;
+                --count;
+            }
+            else
+            {
+                last = *link;
+                link = &(*link)->next;
+            }
+        }
+    }
+
+private:
+    T * first = nullptr;
+    T * last = nullptr;
+    size_t count = 0;
+};
@@ -0,0 +1,83 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+vector<Batch::Entry> Batch::read_manifest(istream & stream)
+{
+    vector<Entry> entries;
+
+    string line;
+    int line_number = 0;
+
+    while (getline(stream, line))
+    {
+        ++line_number;
+
+        istringstream fields(line);
+        Entry entry;
+        if (!(fields >> entry.file1))
+            continue;
+        if (entry.file1[0] == '#')
+            continue;
+
+        string extra;
+        if (!(fields >> entry.file2 >> entry.type) or (fields >> extra))
+        {
+            throw std::runtime_error("Manifest line " + to_string(line_number) +
+                                     ": Expected: file1 file2 type");
+        }
+
+        entries.push_back(entry);
+    }
+
+    return entries;
+}
+
+Batch::Batch(const string & root_dir1, const string & root_dir2,
+             const string & revision1, const string & revision2):
+    source1(Source::at_revision(root_dir1, revision1)),
+    source2(Source::at_revision(root_dir2, revision2))
+{}
+
+void Batch::preparse(const vector<Entry> & entries, int jobs)
+{
+    PhaseTimer timer(d_load_time);
+
+    vector<string> files1;
+    vector<string> files2;
+    for (auto & entry : entries)
+    {
+        files1.push_back(entry.file1);
+        files2.push_back(entry.file2);
+    }
+
+    std::sort(files1.begin(), files1.end());
+    files1.erase(std::unique(files1.begin(), files1.end()), files1.end());
+    std::sort(files2.begin(), files2.end());
+    files2.erase(std::unique(files2.begin(), files2.end()), files2.end());
+
+    std::thread parsing([&]{ source1.preparse(files1, jobs); });
+    source2.preparse(files2, jobs);
+    parsing.join();
+}
+
+void Batch::compare(const Entry & entry, Comparison & comparison)
+{
+    const FileDescriptor * file1;
+    const FileDescriptor * file2;
+    {
+        PhaseTimer timer(d_load_time);
+        file1 = source1.import(entry.file1);
+        file2 = source2.import(entry.file2);
+    }
+
+    if (entry.type == ".")
+        comparison.compare(file1, file2);
+    else
+        comparison.compare(source1, entry.type, source2, entry.type);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "comparison.h"
+
+#include <istream>
+#include <string>
+
+// Runs many file comparisons between two root directories,
+// sharing one Source (and so one parsed pool) per root directory.
+class Batch
+{
+public:
+    struct Entry
+    {
+        string file1;
+        string file2;
+        string type;
+    };
+
+    // Reads one "file1 file2 type" entry per line.
+    // Empty lines and lines starting with '#' are ignored.
+    static vector<Entry> read_manifest(std::istream & stream);
+
+    // Files are read as of the git revisions, unless they are empty.
+    Batch(const string & root_dir1, const string & root_dir2,
+          const string & revision1 = string(), const string & revision2 = string());
+
+    // Parses the files of all entries in advance, each side in 'jobs' threads.
+    void preparse(const vector<Entry> & entries, int jobs);
+
+    void compare(const Entry & entry, Comparison & comparison);
+
+    // Total time spent importing files, in seconds.
+    double load_time() const { return d_load_time; }
+
+private:
+    Source source1;
+    Source source2;
+    double d_load_time = 0;
+};
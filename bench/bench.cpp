@@ -0,0 +1,339 @@
+#include "comparison.h"
+#include "report.h"
+
+#include <benchmark/benchmark.h>
+
+#include <malloc.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+
+using namespace std;
+
+// Peak heap use is measured in an extra untimed run of each benchmark,
+// so counting allocations does not slow down the timed ones.
+
+static atomic<bool> tracking { false };
+static atomic<int64_t> current_bytes { 0 };
+static atomic<int64_t> peak_bytes { 0 };
+
+void * operator new(size_t size)
+{
+    void * pointer = malloc(size ? size : 1);
+    if (!pointer)
+        throw bad_alloc();
+
+    if (tracking.load(memory_order_relaxed))
+    {
+        int64_t bytes = current_bytes += malloc_usable_size(pointer);
+        int64_t peak = peak_bytes.load(memory_order_relaxed);
+        while (bytes > peak and !peak_bytes.compare_exchange_weak(peak, bytes))
+            ;
+    }
+
+    return pointer;
+}
+
+void operator delete(void * pointer) noexcept
+{
+    if (pointer and tracking.load(memory_order_relaxed))
+        current_bytes -= malloc_usable_size(pointer);
+    free(pointer);
+}
+
+void operator delete(void * pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+// Returns the peak heap use of the function, beyond what was allocated before it.
+static
+int64_t measure_peak(const function<void()> & run)
+{
+    current_bytes = 0;
+    peak_bytes = 0;
+    tracking = true;
+    run();
+    tracking = false;
+    return peak_bytes;
+}
+
+static
+void set_peak_counter(benchmark::State & state, const function<void()> & run)
+{
+    state.counters["peak_memory"] = benchmark::Counter(measure_peak(run), benchmark::Counter::kDefaults,
+                                                       benchmark::Counter::OneK::kIs1024);
+}
+
+// Counts and discards the output of reports.
+class NullBuffer : public streambuf
+{
+public:
+    size_t size = 0;
+
+protected:
+    int overflow(int c) override
+    {
+        ++size;
+        return c;
+    }
+
+    streamsize xsputn(const char *, streamsize count) override
+    {
+        size += count;
+        return count;
+    }
+};
+
+// The two versions of a synthetic schema file, with changes of every kind between them.
+struct Schema
+{
+    map<string, string> files1;
+    map<string, string> files2;
+};
+
+static const string file_name = "bench.proto";
+
+static
+Schema make_schema(const function<void(ostream &, bool)> & write)
+{
+    Schema schema;
+    for (bool second : { false, true })
+    {
+        ostringstream out;
+        out << "syntax = \"proto2\";\n\npackage Bench;\n\n";
+        write(out, second);
+        (second ? schema.files2 : schema.files1)[file_name] = out.str();
+    }
+    return schema;
+}
+
+// Writes a field, changed in the second version for some values of i.
+static
+void write_field(ostream & out, bool second, int i, const string & type = "int32")
+{
+    out << "  optional ";
+    if (second and i % 7 == 3)
+        out << "int64";
+    else
+        out << type;
+    out << " f" << i;
+    if (second and i % 11 == 5)
+        out << "_renamed";
+    out << " = " << i + 1 << ";\n";
+}
+
+// N messages of M scalar fields.
+static
+Schema flat_schema(int message_count, int field_count)
+{
+    return make_schema([=](ostream & out, bool second)
+    {
+        for (int i = 0; i < message_count; ++i)
+        {
+            out << "message M" << i << " {\n";
+            for (int j = 0; j < field_count; ++j)
+                write_field(out, second, j);
+            if (second)
+                out << "  optional string added = " << field_count + 1 << ";\n";
+            out << "}\n";
+        }
+    });
+}
+
+// Messages nested in each other to the given depth, at most 31 for protoc, each referring to the next one.
+static
+Schema deep_schema(int depth)
+{
+    return make_schema([=](ostream & out, bool second)
+    {
+        for (int i = 0; i < depth; ++i)
+        {
+            out << "message L" << i << " {\n";
+            if (i + 1 < depth)
+                out << "optional L" << i + 1 << " child = 1;\n";
+        }
+        out << "optional " << (second ? "int64" : "int32") << " value = 2;\n";
+        for (int i = 0; i < depth; ++i)
+            out << "}\n";
+    });
+}
+
+// An enum with the given number of values, used by a message.
+static
+Schema wide_enum_schema(int value_count)
+{
+    return make_schema([=](ostream & out, bool second)
+    {
+        out << "enum E {\n";
+        for (int i = 0; i < value_count; ++i)
+        {
+            if (second and i % 17 == 9)
+                continue;
+            out << "  V" << i;
+            if (second and i % 11 == 5)
+                out << "_renamed";
+            out << " = " << (second and i % 13 == 7 ? i + value_count : i) << ";\n";
+        }
+        if (second)
+            out << "  ADDED = " << 2 * value_count << ";\n";
+        out << "}\n\nmessage M {\n  optional E e = 1;\n}\n";
+    });
+}
+
+// N messages, each with fields of all K shared types, which change.
+static
+Schema shared_schema(int message_count, int shared_count)
+{
+    return make_schema([=](ostream & out, bool second)
+    {
+        for (int k = 0; k < shared_count; ++k)
+        {
+            out << "message S" << k << " {\n";
+            for (int j = 0; j < 10; ++j)
+                write_field(out, second, j);
+            out << "}\n";
+        }
+        for (int i = 0; i < message_count; ++i)
+        {
+            out << "message M" << i << " {\n";
+            for (int k = 0; k < shared_count; ++k)
+                out << "  optional S" << k << " s" << k << " = " << k + 1 << ";\n";
+            out << "}\n";
+        }
+    });
+}
+
+// A ring of N messages referring to themselves and to the next one, like msg_recursion.
+static
+Schema recursive_schema(int message_count)
+{
+    return make_schema([=](ostream & out, bool second)
+    {
+        for (int i = 0; i < message_count; ++i)
+        {
+            out << "message R" << i << " {\n";
+            out << "  optional R" << i << " self = 1;\n";
+            out << "  optional R" << (i + 1) % message_count << " next = 2;\n";
+            out << "  optional " << (second and i == 0 ? "int64" : "int32") << " value = 3;\n";
+            out << "}\n";
+        }
+    });
+}
+
+// Parses both versions of the schema.
+static
+void bench_load(benchmark::State & state, const Schema & schema)
+{
+    for (auto _ : state)
+    {
+        Source source1(file_name, schema.files1);
+        Source source2(file_name, schema.files2);
+        benchmark::DoNotOptimize(source1.file_descriptor());
+        benchmark::DoNotOptimize(source2.file_descriptor());
+    }
+
+    set_peak_counter(state, [&]
+    {
+        Source source1(file_name, schema.files1);
+        Source source2(file_name, schema.files2);
+    });
+}
+
+// Compares all types of the parsed schemas.
+static
+void bench_compare(benchmark::State & state, const Schema & schema)
+{
+    Source source1(file_name, schema.files1);
+    Source source2(file_name, schema.files2);
+
+    for (auto _ : state)
+    {
+        Comparison comparison;
+        comparison.compare(source1, source2);
+        benchmark::DoNotOptimize(comparison.root.subsections.size());
+    }
+
+    set_peak_counter(state, [&]
+    {
+        Comparison comparison;
+        comparison.compare(source1, source2);
+    });
+}
+
+// Writes the result of the comparison as text.
+static
+void bench_print(benchmark::State & state, const Schema & schema)
+{
+    Source source1(file_name, schema.files1);
+    Source source2(file_name, schema.files2);
+
+    Comparison comparison;
+    comparison.compare(source1, source2);
+
+    size_t size = 0;
+    for (auto _ : state)
+    {
+        NullBuffer buffer;
+        ostream out(&buffer);
+        TextReporter reporter(out);
+        comparison.report(reporter);
+        size = buffer.size;
+    }
+
+    state.SetBytesProcessed(int64_t(state.iterations()) * size);
+}
+
+static
+void register_schema(const string & name, const function<Schema()> & generate)
+{
+    // Generated once, and only if one of the benchmarks is run.
+    auto schema = make_shared<Schema>();
+    auto get = [=]() -> const Schema &
+    {
+        if (schema->files1.empty())
+            *schema = generate();
+        return *schema;
+    };
+
+    benchmark::RegisterBenchmark(("load/" + name).c_str(), [=](benchmark::State & state)
+    {
+        bench_load(state, get());
+    })->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("compare/" + name).c_str(), [=](benchmark::State & state)
+    {
+        bench_compare(state, get());
+    })->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("print/" + name).c_str(), [=](benchmark::State & state)
+    {
+        bench_print(state, get());
+    })->Unit(benchmark::kMillisecond);
+}
+
+int main(int argc, char * argv[])
+{
+    register_schema("flat/100x10", [] { return flat_schema(100, 10); });
+    register_schema("flat/1000x100", [] { return flat_schema(1000, 100); });
+    register_schema("flat/10x2000", [] { return flat_schema(10, 2000); });
+    register_schema("deep/10", [] { return deep_schema(10); });
+    register_schema("deep/30", [] { return deep_schema(30); });
+    register_schema("wide_enum/10000", [] { return wide_enum_schema(10000); });
+    register_schema("shared/1000x20", [] { return shared_schema(1000, 20); });
+    register_schema("recursive/1", [] { return recursive_schema(1); });
+    register_schema("recursive/1000", [] { return recursive_schema(1000); });
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "cache.h"
+#include "hash.h"
+
+#include <google/protobuf/descriptor.pb.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+#include <unistd.h>
+
+using namespace std;
+
+using google::protobuf::FileDescriptor;
+using google::protobuf::FileDescriptorSet;
+
+namespace {
+
+bool read_file(const string & path, string & contents)
+{
+    ifstream file(path, ios::binary);
+    if (!file.is_open())
+        return false;
+
+    ostringstream data;
+    data << file.rdbuf();
+    contents = data.str();
+    return true;
+}
+
+bool add_file(Hash & hash, const string & root_dir, const string & file_path)
+{
+    string contents;
+    if (!read_file(root_dir + "/" + file_path, contents))
+        return false;
+
+    hash.add(file_path);
+    hash.add(contents);
+    return true;
+}
+
+// Adds the file after its dependencies, as required for building a pool.
+void add_closure(const FileDescriptor * file, unordered_set<const FileDescriptor*> & added,
+                 FileDescriptorSet & set)
+{
+    if (!added.insert(file).second)
+        return;
+
+    for (int i = 0; i < file->dependency_count(); ++i)
+        add_closure(file->dependency(i), added, set);
+
+    file->CopyTo(set.add_file());
+}
+
+// Writes the file, so that it appears complete or not at all.
+bool write_file(const string & path, const string & contents)
+{
+    // Unique to the thread, as both sides of a comparison may be stored at once.
+    string temp_path = path + ".tmp" + to_string(getpid()) + "." +
+            to_string(hash<thread::id>()(this_thread::get_id()));
+
+    {
+        ofstream file(temp_path, ios::binary);
+        if (!file.is_open() or !file.write(contents.data(), contents.size()))
+            return false;
+    }
+
+    error_code error;
+    filesystem::rename(temp_path, path, error);
+    if (error)
+    {
+        filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    return true;
+}
+
+}
+
+SchemaCache::SchemaCache(const string & cache_dir):
+    cache_dir(cache_dir)
+{}
+
+string SchemaCache::imports_path(const string & root_dir, const string & file_path) const
+{
+    Hash hash;
+    if (!add_file(hash, root_dir, file_path))
+        return string();
+
+    return cache_dir + "/" + hash.hex() + ".imports";
+}
+
+string SchemaCache::set_path(const string & root_dir, const string & file_path,
+                             const vector<string> & imports) const
+{
+    Hash hash;
+    if (!add_file(hash, root_dir, file_path))
+        return string();
+
+    for (auto & import : imports)
+    {
+        if (!add_file(hash, root_dir, import))
+            return string();
+    }
+
+    return cache_dir + "/" + hash.hex() + ".pb";
+}
+
+string SchemaCache::find(const string & root_dir, const string & file_path) const
+{
+    ifstream imports_file(imports_path(root_dir, file_path));
+    if (!imports_file.is_open())
+        return string();
+
+    vector<string> imports;
+    string import;
+    while (getline(imports_file, import))
+        imports.push_back(import);
+
+    string path = set_path(root_dir, file_path, imports);
+    if (path.empty() or !filesystem::is_regular_file(path))
+        return string();
+
+    return path;
+}
+
+void SchemaCache::store(const string & root_dir, const FileDescriptor * file) const
+{
+    FileDescriptorSet set;
+    unordered_set<const FileDescriptor*> added;
+    add_closure(file, added, set);
+
+    vector<string> imports;
+    string imports_text;
+    for (auto & proto : set.file())
+    {
+        if (proto.name() == file->name())
+            continue;
+        imports.push_back(proto.name());
+        imports_text += proto.name() + "\n";
+    }
+
+    error_code error;
+    filesystem::create_directories(cache_dir, error);
+
+    string path = set_path(root_dir, file->name(), imports);
+    string data;
+
+    bool stored = !error and !path.empty() and set.SerializeToString(&data) and
+            write_file(path, data) and
+            write_file(imports_path(root_dir, file->name()), imports_text);
+
+    if (!stored)
+        cerr << "Warning: Failed to store " << file->name() << " in cache: " << cache_dir << endl;
+}
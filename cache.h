@@ -0,0 +1,33 @@
+#pragma once
+
+#include <google/protobuf/descriptor.h>
+
+#include <string>
+#include <vector>
+
+// A directory of descriptor sets of previously imported .proto files.
+// Each set contains a file and its transitive imports, and is keyed
+// by a hash of the contents of all these files.
+// The list of imports of a file is recorded separately, keyed by
+// a hash of the file alone, so that the key of a set can be computed
+// without parsing.
+class SchemaCache
+{
+public:
+    explicit SchemaCache(const std::string & cache_dir);
+
+    // Returns the path of the descriptor set for the file in the root directory,
+    // or an empty string if there is none for the current file contents.
+    std::string find(const std::string & root_dir, const std::string & file_path) const;
+
+    // Stores the descriptor set of the imported file and its imports.
+    // Failures are reported as warnings and otherwise ignored.
+    void store(const std::string & root_dir, const google::protobuf::FileDescriptor * file) const;
+
+private:
+    std::string imports_path(const std::string & root_dir, const std::string & file_path) const;
+    std::string set_path(const std::string & root_dir, const std::string & file_path,
+                         const std::vector<std::string> & imports) const;
+
+    std::string cache_dir;
+};
@@ -1,99 +1,122 @@
 #include "comparison.h"
+#include "report.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <condition_variable>
+#include <unordered_set>
 
 using namespace std;
 
-string Comparison::Item::message() const
+void Comparison::Item::write(ostream & out) const
 {
-    string msg;
-
     switch (type)
     {
     case Enum_Value_Name_Changed:
-        msg = "Value name changed";
+        out << "Value name changed";
         break;
     case Enum_Value_Id_Changed:
-        msg = "Value ID changed";
+        out << "Value ID changed";
         break;
     case Enum_Value_Added:
-        msg = "Value added";
+        out << "Value added";
         break;
     case Enum_Value_Removed:
-        msg = "Value removed";
+        out << "Value removed";
         break;
     case Message_Field_Name_Changed:
-        msg = "Name changed";
+        out << "Name changed";
         break;
     case Message_Field_Id_Changed:
-        msg = "ID changed";
+        out << "ID changed";
         break;
     case Message_Field_Label_Changed:
-        msg = "Label changed";
+        out << "Label changed";
         break;
     case Message_Field_Type_Changed:
-        msg = "Type changed";
+        out << "Type changed";
         break;
     case Message_Field_Default_Value_Changed:
-        msg = "Default value changed";
+        out << "Default value changed";
         break;
     case Message_Field_Added:
-        msg = "Field added";
+        out << "Field added";
         break;
     case Message_Field_Removed:
-        msg = "Field removed";
+        out << "Field removed";
         break;
     case File_Message_Added:
-        msg = "Message added";
+        out << "Message added";
         break;
     case File_Message_Removed:
-        msg = "Message removed";
+        out << "Message removed";
         break;
     case File_Enum_Added:
-        msg = "Enum added";
+        out << "Enum added";
         break;
     case File_Enum_Removed:
-        msg = "Enum removed";
+        out << "Enum removed";
         break;
     case Name_Missing:
-        msg = "Name missing";
+        out << "Name missing";
         break;
     default:
-        msg = "?";
-        return msg;
+        out << "?";
+        return;
     }
 
-    msg += ": " + a + " -> " + b;
-
-    return msg;
+    out << ": " << a << " -> " << b;
 }
 
-string Comparison::Section::message() const
+string Comparison::Item::message() const
 {
     ostringstream msg;
+    write(msg);
+    return msg.str();
+}
 
+void Comparison::Section::write(ostream & out) const
+{
     switch(type)
     {
     case Root_Section:
-        msg << "/";
+        out << "/";
         break;
     case Message_Comparison:
-        msg << "Comparing messages: " << a << " -> " << b;
+        out << "Comparing messages: " << a << " -> " << b;
         break;
     case Message_Field_Comparison:
-        msg << "Comparing fields: " << a << " -> " << b;
+        out << "Comparing fields: " << a << " -> " << b;
         break;
     case Enum_Comparison:
-        msg << "Comparing enums: " << a << " -> " << b;
+        out << "Comparing enums: " << a << " -> " << b;
         break;
     case Enum_Value_Comparison:
-        msg << "Comparing enum values: " << a << " -> " << b;
+        out << "Comparing enum values: " << a << " -> " << b;
         break;
     default:
-        msg << "?";
+        out << "?";
     }
+}
 
+string Comparison::Section::message() const
+{
+    ostringstream msg;
+    write(msg);
+    return msg.str();
+}
+
+void Comparison::Reference::write(ostream & out) const
+{
+    out << "Required by " << a << " -> " << b;
+}
+
+string Comparison::Reference::message() const
+{
+    ostringstream msg;
+    write(msg);
     return msg.str();
 }
 
@@ -132,33 +155,86 @@ void print_field(const FieldDescriptor * field)
     }
 }
 
-void Comparison::Section::print(int level)
+void Comparison::Section::report(Reporter & reporter) const
+{
+    reporter.begin_section(*this);
+
+    for (auto & item : items)
+    {
+        reporter.item(item);
+    }
+
+    for (auto & subsection : subsections)
+    {
+        subsection.report(reporter);
+    }
+
+    reporter.end_section(*this);
+}
+
+void Comparison::Section::print(int level) const
 {
-    cout << string(level*2, ' ') << message() << endl;
+    TextReporter reporter(cout, level);
+    report(reporter);
+}
+
+Comparison::Comparison(const Options & options, const Baseline * baseline):
+    options(options),
+    baseline(baseline),
+    fingerprints(baseline ? &baseline->fingerprints : nullptr)
+{}
 
-    ++level;
+// Counts the sections below the given one and their items, using an explicit stack.
+static
+void count_sections(const Comparison::Section & root, size_t & sections, size_t & items)
+{
+    vector<const Comparison::Section*> stack { &root };
+    while (!stack.empty())
+    {
+        auto * section = stack.back();
+        stack.pop_back();
 
-    string subprefix(level*2, ' ');
+        items += section->items.size();
+        sections += section->subsections.size();
+        for (auto & subsection : section->subsections)
+            stack.push_back(&subsection);
+    }
+}
 
-    for (auto & note : notes)
+void Comparison::report(Reporter & reporter)
+{
+    if (options.statistics)
     {
-        cout << subprefix << note << endl;
+        stats.sections_allocated = stats.items_allocated = 0;
+        count_sections(root, stats.sections_allocated, stats.items_allocated);
     }
 
-    for (auto & item : items)
     {
-        cout << subprefix << "* " << item.message() << endl;
+        PhaseTimer timer(stats.trim_time);
+        root.trim();
     }
 
-    for (auto & subsection : subsections)
+    if (options.statistics)
     {
-        subsection.print(level);
+        stats.sections_retained = stats.items_retained = 0;
+        count_sections(root, stats.sections_retained, stats.items_retained);
     }
+
+    PhaseTimer timer(stats.report_time);
+    root.report(reporter);
 }
 
-Comparison::Comparison(const Options & options):
-    options(options)
-{}
+Statistics Comparison::statistics()
+{
+    Statistics result = stats;
+    result.types = visited_types;
+    result.identical_types = skipped_types;
+    result.fields = visited_fields;
+    result.values = visited_values;
+    result.memo_hits = compared.hits();
+    result.memo_misses = compared.misses();
+    return result;
+}
 
 bool Comparison::compare_default_value(const FieldDescriptor * field1, const FieldDescriptor * field2)
 {
@@ -196,223 +272,1097 @@ bool Comparison::compare_default_value(const FieldDescriptor * field1, const Fie
     }
 }
 
-Comparison::Section * Comparison::compare(const EnumDescriptor * enum1, const EnumDescriptor * enum2)
+std::pair<Comparison::TypeEntry*, bool> Comparison::Memo::insert(const Descriptor * desc1, const Descriptor * desc2)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto result = entries.try_emplace(Key(desc1, desc2));
+    auto & entry = result.first->second;
+    ++(result.second ? miss_count : hit_count);
+    if (result.second)
+    {
+        entry.desc1 = desc1;
+        entry.desc2 = desc2;
+    }
+    return { &entry, result.second };
+}
+
+std::pair<Comparison::TypeEntry*, bool> Comparison::Memo::insert(const EnumDescriptor * enum1, const EnumDescriptor * enum2)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto result = entries.try_emplace(Key(enum1, enum2));
+    auto & entry = result.first->second;
+    ++(result.second ? miss_count : hit_count);
+    if (result.second)
+    {
+        entry.enum1 = enum1;
+        entry.enum2 = enum2;
+    }
+    return { &entry, result.second };
+}
+
+void Comparison::Memo::reserve(size_t count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.reserve(count);
+}
+
+size_t Comparison::Memo::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+Comparison::TypeEntry * Comparison::Memo::find(const void * type1, const void * type2)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = entries.find(Key(type1, type2));
+    return entry == entries.end() ? nullptr : &entry->second;
+}
+
+size_t Comparison::Memo::hits()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hit_count;
+}
+
+size_t Comparison::Memo::misses()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return miss_count;
+}
+
+size_t Comparison::type_count(const FileDescriptor * file)
+{
+    std::unordered_set<const FileDescriptor*> visited { file };
+    vector<const FileDescriptor*> files { file };
+    vector<const Descriptor*> messages;
+    size_t count = 0;
+
+    while (!files.empty())
+    {
+        auto * file = files.back();
+        files.pop_back();
+
+        count += file->enum_type_count() + file->message_type_count();
+        for (int i = 0; i < file->message_type_count(); ++i)
+            messages.push_back(file->message_type(i));
+
+        for (int i = 0; i < file->dependency_count(); ++i)
+        {
+            if (visited.insert(file->dependency(i)).second)
+                files.push_back(file->dependency(i));
+        }
+    }
+
+    while (!messages.empty())
+    {
+        auto * desc = messages.back();
+        messages.pop_back();
+
+        count += desc->enum_type_count() + desc->nested_type_count();
+        for (int i = 0; i < desc->nested_type_count(); ++i)
+            messages.push_back(desc->nested_type(i));
+    }
+
+    return count;
+}
+
+namespace {
+
+template <typename Key>
+using Keys = Comparison::Baseline::Keys<Key>;
+
+// For each field or value of both sides, the index of its match on the other side, or -1.
+// Aliases of an enum value all match the first value with the same number, as in FindValueByNumber().
+struct Matching
+{
+    vector<int> match1;
+    vector<int> match2;
+};
+
+template <typename Key>
+void merge_keys(const Keys<Key> & keys1, const Keys<Key> & keys2, Matching & matching)
+{
+    matching.match1.assign(keys1.size(), -1);
+    matching.match2.assign(keys2.size(), -1);
+
+    size_t i = 0;
+    size_t j = 0;
+    while (i < keys1.size() and j < keys2.size())
+    {
+        if (keys1[i].first < keys2[j].first)
+        {
+            ++i;
+        }
+        else if (keys2[j].first < keys1[i].first)
+        {
+            ++j;
+        }
+        else
+        {
+            Key key = keys1[i].first;
+            int first1 = keys1[i].second;
+            int first2 = keys2[j].second;
+            for (; i < keys1.size() and keys1[i].first == key; ++i)
+                matching.match1[keys1[i].second] = first2;
+            for (; j < keys2.size() and keys2[j].first == key; ++j)
+                matching.match2[keys2[j].second] = first1;
+        }
+    }
+}
+
+int element_count(const Descriptor * desc) { return desc->field_count(); }
+const FieldDescriptor * element(const Descriptor * desc, int i) { return desc->field(i); }
+int element_count(const EnumDescriptor * enum_desc) { return enum_desc->value_count(); }
+const EnumValueDescriptor * element(const EnumDescriptor * enum_desc, int i) { return enum_desc->value(i); }
+
+// Sorts the fields or values of the type by number, or by name.
+template <typename Key, typename Type>
+void collect_keys(const Type * type, Keys<Key> & keys)
 {
-    string key = enum1->full_name() + ":" + enum2->full_name();
-    if (compared.count(key))
-        return compared.at(key);
+    keys.clear();
+    keys.reserve(element_count(type));
+    for (int i = 0; i < element_count(type); ++i)
+    {
+        if constexpr (std::is_same<Key, int>::value)
+            keys.emplace_back(element(type, i)->number(), i);
+        else
+            keys.emplace_back(element(type, i)->name(), i);
+    }
+
+    // Equal keys are ordered by index, so the first declared element comes first.
+    sort(keys.begin(), keys.end());
+}
+
+template <typename Key, typename Type>
+const Keys<Key> & sorted_keys(const Type * type, const Comparison::Baseline * baseline, Keys<Key> & buffer)
+{
+    if (baseline)
+    {
+        const Keys<Key> * keys;
+        if constexpr (std::is_same<Key, int>::value)
+            keys = baseline->numbers(type);
+        else
+            keys = baseline->names(type);
+        if (keys)
+            return *keys;
+    }
+
+    collect_keys(type, buffer);
+    return buffer;
+}
+
+// Matches fields or values by number if 'binary', or by name otherwise, in a single merge pass
+// over both sides sorted by key, using those sorted in the baseline if given.
+// The result is reused by the next call in the same thread.
+template <typename Type>
+const Matching & match(const Type * type1, const Type * type2, bool binary, const Comparison::Baseline * baseline)
+{
+    thread_local Matching matching;
+
+    if (binary)
+    {
+        thread_local Keys<int> buffer1, buffer2;
+        merge_keys(sorted_keys(type1, baseline, buffer1), sorted_keys(type2, baseline, buffer2), matching);
+    }
+    else
+    {
+        thread_local Keys<string_view> buffer1, buffer2;
+        merge_keys(sorted_keys(type1, baseline, buffer1), sorted_keys(type2, baseline, buffer2), matching);
+    }
+
+    return matching;
+}
+
+}
+
+Comparison::Baseline::Baseline(const FileDescriptor * file, const Options & options):
+    binary(options.binary)
+{
+    bool use_fingerprints = options.skip_identical or options.check_fingerprints;
+
+    // All types of the file and its dependencies, using explicit stacks.
+    vector<const FileDescriptor*> files { file };
+    unordered_set<const FileDescriptor*> visited { file };
+    vector<const Descriptor*> messages;
 
-    auto & section = root.add_subsection(Enum_Comparison, enum1->full_name(), enum2->full_name());
-    compared.emplace(key, &section);
+    auto add_enum = [&](const EnumDescriptor * enum_desc)
+    {
+        if (use_fingerprints)
+            fingerprints.add(enum_desc);
+        if (binary)
+            collect_keys(enum_desc, sorted_numbers[enum_desc]);
+        else
+            collect_keys(enum_desc, sorted_names[enum_desc]);
+    };
+
+    while (!files.empty())
+    {
+        auto * current = files.back();
+        files.pop_back();
+
+        for (int i = 0; i < current->dependency_count(); ++i)
+        {
+            if (visited.insert(current->dependency(i)).second)
+                files.push_back(current->dependency(i));
+        }
+
+        for (int i = 0; i < current->enum_type_count(); ++i)
+            add_enum(current->enum_type(i));
+        for (int i = 0; i < current->message_type_count(); ++i)
+            messages.push_back(current->message_type(i));
+
+        while (!messages.empty())
+        {
+            auto * desc = messages.back();
+            messages.pop_back();
+
+            if (use_fingerprints)
+                fingerprints.add(desc);
+            if (binary)
+                collect_keys(desc, sorted_numbers[desc]);
+            else
+                collect_keys(desc, sorted_names[desc]);
+
+            for (int i = 0; i < desc->enum_type_count(); ++i)
+                add_enum(desc->enum_type(i));
+            for (int i = 0; i < desc->nested_type_count(); ++i)
+                messages.push_back(desc->nested_type(i));
+        }
+    }
+}
+
+const Comparison::Baseline::Keys<int> * Comparison::Baseline::numbers(const void * type) const
+{
+    auto keys = sorted_numbers.find(type);
+    return keys == sorted_numbers.end() ? nullptr : &keys->second;
+}
+
+const Comparison::Baseline::Keys<string_view> * Comparison::Baseline::names(const void * type) const
+{
+    auto keys = sorted_names.find(type);
+    return keys == sorted_names.end() ? nullptr : &keys->second;
+}
+
+void Comparison::compare_values(TypeEntry & entry, Arena & arena)
+{
+    auto * enum1 = entry.enum1;
+    auto * enum2 = entry.enum2;
+
+    entry.section = arena.make<Section>(&arena, Enum_Comparison, enum1->full_name(), enum2->full_name());
+    auto & section = *entry.section;
+
+    auto & matching = match(enum1, enum2, options.binary, baseline);
 
     for (int i = 0; i < enum1->value_count(); ++i)
     {
         auto * value1 = enum1->value(i);
-        auto * value2 = options.binary ?
-                    enum2->FindValueByNumber(value1->number()) :
-                    enum2->FindValueByName(value1->name());
+        int j = matching.match1[i];
+        auto * value2 = j < 0 ? nullptr : enum2->value(j);
 
         if (value2)
         {
+            if (!finds(Enum_Value_Id_Changed) and !finds(Enum_Value_Name_Changed))
+                continue;
+
             auto & subsection = section.add_subsection(Enum_Value_Comparison, value1->name(), value2->name());
 
-            if (value1->number() != value2->number())
+            if (finds(Enum_Value_Id_Changed) and value1->number() != value2->number())
             {
                 subsection.add_item(Enum_Value_Id_Changed,
-                                    to_string(value1->number()), to_string(value2->number()));
+                                    names.number(value1->number()), names.number(value2->number()));
             }
-            if (value1->name() != value2->name())
+            if (finds(Enum_Value_Name_Changed) and value1->name() != value2->name())
             {
                 subsection.add_item(Enum_Value_Name_Changed,
                                     value1->name(), value2->name());
             }
         }
-        else
+        else if (finds(Enum_Value_Removed))
         {
-            string value1_id = options.binary ? to_string(value1->number()) : value1->name();
+            string_view value1_id = options.binary ? names.number(value1->number()) : value1->name();
             section.add_item(Enum_Value_Removed, value1_id, "");
         }
     }
 
-    for (int i = 0; i < enum2->value_count(); ++i)
+    for (int i = 0; i < enum2->value_count() and finds(Enum_Value_Added); ++i)
     {
         auto * value2 = enum2->value(i);
-        auto * value1 = options.binary ?
-                    enum1->FindValueByNumber(value2->number()) :
-                    enum1->FindValueByName(value2->name());
 
-        if (!value1)
+        if (matching.match2[i] < 0)
         {
-            string value2_id = options.binary ? to_string(value2->number()) : value2->name();
+            string_view value2_id = options.binary ? names.number(value2->number()) : value2->name();
             section.add_item(Enum_Value_Added, "", value2_id);
         }
     }
+}
+
+Comparison::Section * Comparison::compare(const FieldDescriptor * field1, const FieldDescriptor * field2, Section & parent)
+{
+    Section * section = nullptr;
+
+    auto add_item = [&](ItemType type, string_view a, string_view b)
+    {
+        if (!section)
+            section = &parent.add_subsection(Message_Field_Comparison, field1->name(), field2->name());
+        section->add_item(type, a, b);
+    };
+
+    if (finds(Message_Field_Name_Changed) and field1->name() != field2->name())
+    {
+        add_item(Message_Field_Name_Changed, field1->name(), field2->name());
+    }
+
+    if (finds(Message_Field_Id_Changed) and field1->number() != field2->number())
+    {
+        add_item(Message_Field_Id_Changed, names.number(field1->number()), names.number(field2->number()));
+    }
+
+    if (finds(Message_Field_Label_Changed) and field1->label() != field2->label())
+    {
+        add_item(Message_Field_Label_Changed, "", "");
+    }
 
-    return &section;
+    if (finds(Message_Field_Type_Changed) and field1->type() != field2->type())
+    {
+        add_item(Message_Field_Type_Changed, field1->type_name(), field2->type_name());
+    }
+
+    if (finds(Message_Field_Default_Value_Changed) and field1->cpp_type() == field2->cpp_type())
+    {
+        if (!compare_default_value(field1, field2))
+        {
+            add_item(Message_Field_Default_Value_Changed, "", "");
+        }
+    }
+
+    return section;
 }
 
-Comparison::Section Comparison::compare(const FieldDescriptor * field1, const FieldDescriptor * field2)
+void Comparison::compare_fields(TypeEntry & entry, vector<TypeEntry*> & discovered, Arena & arena)
 {
-    Section section(Message_Field_Comparison, field1->name(), field2->name());
+    auto * desc1 = entry.desc1;
+    auto * desc2 = entry.desc2;
+
+    entry.section = arena.make<Section>(&arena, Message_Comparison, desc1->full_name(), desc2->full_name());
+    auto & section = *entry.section;
+
+    auto & matching = match(desc1, desc2, options.binary, baseline);
+
+    for (int i = 0; i < desc1->field_count(); ++i)
+    {
+        auto * field1 = desc1->field(i);
+        int j = matching.match1[i];
+        auto * field2 = j < 0 ? nullptr : desc2->field(j);
+
+        FieldMatch match;
+        match.field1 = field1;
+        match.field2 = field2;
+
+        if (field2)
+        {
+            match.section = compare(field1, field2, section);
+
+            std::pair<TypeEntry*, bool> type { nullptr, false };
+
+            if (field1->type() != field2->type())
+                ;
+            // Enums are compared only if they can have items to find.
+            else if (field1->type() == FieldDescriptor::TYPE_ENUM and compares_values())
+            {
+                if (identical(field1->enum_type(), field2->enum_type()))
+                    ++skipped_types;
+                else
+                    type = compared.insert(field1->enum_type(), field2->enum_type());
+            }
+            else if (field1->type() == FieldDescriptor::TYPE_MESSAGE)
+            {
+                if (identical(field1->message_type(), field2->message_type()))
+                    ++skipped_types;
+                else
+                    type = compared.insert(field1->message_type(), field2->message_type());
+            }
+
+            match.type = type.first;
+            if (type.second)
+                discovered.push_back(type.first);
 
-    if (field1->name() != field2->name())
+            // Unchanged fields of other types need nothing more.
+            if (!match.section and !match.type)
+                continue;
+        }
+        else
+        {
+            if (!finds(Message_Field_Removed))
+                continue;
+
+            string_view field1_id = options.binary ? names.number(field1->number()) : field1->name();
+            section.add_item(Message_Field_Removed, field1_id, "");
+        }
+
+        entry.fields.push_back(match);
+    }
+
+    for (int i = 0; i < desc2->field_count() and finds(Message_Field_Added); ++i)
     {
-        section.add_item(Message_Field_Name_Changed, field1->name(), field2->name());
+        auto * field2 = desc2->field(i);
+
+        if (matching.match2[i] < 0)
+        {
+            string_view field2_id = options.binary ? names.number(field2->number()) : field2->name();
+            section.add_item(Message_Field_Added, "", field2_id);
+        }
     }
+}
 
-    if (field1->number() != field2->number())
+void Comparison::compare_entry(TypeEntry & entry, vector<TypeEntry*> & discovered, Arena & arena)
+{
+    // An identical pair gets an empty section, like any other pair without differences.
+    if (entry.desc1 and identical(entry.desc1, entry.desc2))
     {
-        section.add_item(Message_Field_Id_Changed, to_string(field1->number()), to_string(field2->number()));
+        ++skipped_types;
+        entry.section = arena.make<Section>(&arena, Message_Comparison, entry.desc1->full_name(), entry.desc2->full_name());
+        return;
+    }
+    if (entry.enum1 and identical(entry.enum1, entry.enum2))
+    {
+        ++skipped_types;
+        entry.section = arena.make<Section>(&arena, Enum_Comparison, entry.enum1->full_name(), entry.enum2->full_name());
+        return;
     }
 
-    if (field1->label() != field2->label())
+    // A pair without items to find, compared on its own, gets an empty section too.
+    if (entry.desc1 and !compares_messages())
+    {
+        entry.section = arena.make<Section>(&arena, Message_Comparison, entry.desc1->full_name(), entry.desc2->full_name());
+        return;
+    }
+    if (entry.enum1 and !compares_values())
     {
-        section.add_item(Message_Field_Label_Changed, "", "");
+        entry.section = arena.make<Section>(&arena, Enum_Comparison, entry.enum1->full_name(), entry.enum2->full_name());
+        return;
     }
 
-    if (field1->type() != field2->type())
+    ++visited_types;
+    if (entry.desc1)
     {
-        section.add_item(Message_Field_Type_Changed, field1->type_name(), field2->type_name());
+        visited_fields += entry.desc1->field_count() + entry.desc2->field_count();
+        compare_fields(entry, discovered, arena);
     }
-    else if (field1->type() == FieldDescriptor::TYPE_ENUM)
+    else
     {
-        auto * enum1 = field1->enum_type();
-        auto * enum2 = field2->enum_type();
+        visited_values += entry.enum1->value_count() + entry.enum2->value_count();
+        compare_values(entry, arena);
+    }
 
-        auto * type_comparison = compare(enum1, enum2);
-        type_comparison->notes.push_back("Required by " + field1->full_name() + " -> " + field2->full_name());
+    entry.breaking = has_breaking_items(*entry.section);
+    if (entry.breaking)
+        found_breaking = true;
 
-        type_comparison->trim();
-        if (!type_comparison->is_empty())
+    if (!keep_sections())
+    {
+        // Only the types of fields are still needed, to find breaking changes they cause.
+        entry.section = nullptr;
+        if (types_only)
         {
-            section.add_item(Message_Field_Type_Changed, enum1->full_name(), enum2->full_name());
+            for (auto & match : entry.fields)
+                match.section = nullptr;
         }
+        else
+        {
+            vector<FieldMatch>().swap(entry.fields);
+        }
+        arena.clear();
+    }
+}
+
+bool Comparison::is_breaking(ItemType type, bool binary)
+{
+    switch (type)
+    {
+    case Enum_Value_Added:
+    case Message_Field_Added:
+    case File_Message_Added:
+    case File_Enum_Added:
+        return false;
+    // Names are not serialized in the binary format,
+    // and fields of removed types are compared as fields of other types.
+    case Enum_Value_Name_Changed:
+    case Message_Field_Name_Changed:
+    case File_Message_Removed:
+    case File_Enum_Removed:
+        return !binary;
+    default:
+        return true;
     }
-    else if (field1->type() == FieldDescriptor::TYPE_MESSAGE)
+}
+
+Comparison::ItemTypes Comparison::breaking_items(bool binary)
+{
+    ItemTypes items = 0;
+    for (int type = 0; type <= Name_Missing; ++type)
     {
-        auto * msg1 = field1->message_type();
-        auto * msg2 = field2->message_type();
+        if (is_breaking(ItemType(type), binary))
+            items |= item_bit(ItemType(type));
+    }
+    return items;
+}
 
-        auto * type_comparison = compare(msg1, msg2);
-        type_comparison->notes.push_back("Required by " + field1->full_name() + " -> " + field2->full_name());
+bool Comparison::compares_values() const
+{
+    return options.items & (item_bit(Enum_Value_Name_Changed) | item_bit(Enum_Value_Id_Changed) |
+                            item_bit(Enum_Value_Added) | item_bit(Enum_Value_Removed));
+}
 
-        type_comparison->trim();
-        if (!type_comparison->is_empty())
+bool Comparison::compares_messages() const
+{
+    // Fields of messages lead to the enums they refer to.
+    return compares_values() or
+            options.items & (item_bit(Message_Field_Name_Changed) | item_bit(Message_Field_Id_Changed) |
+                             item_bit(Message_Field_Label_Changed) | item_bit(Message_Field_Type_Changed) |
+                             item_bit(Message_Field_Default_Value_Changed) |
+                             item_bit(Message_Field_Added) | item_bit(Message_Field_Removed));
+}
+
+bool Comparison::has_breaking_items(const Section & section) const
+{
+    for (auto & item : section.items)
+    {
+        if (is_breaking(item.type, options.binary))
+            return true;
+    }
+
+    for (auto & subsection : section.subsections)
+    {
+        if (has_breaking_items(subsection))
+            return true;
+    }
+
+    return false;
+}
+
+void Comparison::compare_pending()
+{
+    PhaseTimer timer(stats.compare_time);
+
+    if (options.jobs <= 1)
+    {
+        while (!pending.empty() and !stopped())
         {
-            section.add_item(Message_Field_Type_Changed, msg1->full_name(), msg2->full_name());
+            auto * entry = pending.back();
+            pending.pop_back();
+            compare_entry(*entry, pending, keep_sections() ? arena : scratch);
         }
+        pending.clear();
+        return;
     }
 
-    if (field1->cpp_type() == field2->cpp_type())
+    std::mutex mutex;
+    std::condition_variable changed;
+    int active = 0;
+
+    for (int i = 0; i < options.jobs; ++i)
+        worker_arenas.emplace_back();
+
+    auto work = [&](Arena & arena)
     {
-        if (!compare_default_value(field1, field2))
+        vector<TypeEntry*> discovered;
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true)
         {
-            section.add_item(Message_Field_Default_Value_Changed, "", "");
+            changed.wait(lock, [&]{ return !pending.empty() or active == 0 or stopped(); });
+            if (pending.empty() or stopped())
+                break;
+
+            auto * entry = pending.back();
+            pending.pop_back();
+            ++active;
+
+            lock.unlock();
+            compare_entry(*entry, discovered, arena);
+            lock.lock();
+
+            --active;
+            pending.insert(pending.end(), discovered.begin(), discovered.end());
+            discovered.clear();
+            changed.notify_all();
         }
+    };
+
+    vector<std::thread> threads;
+    for (auto arena = std::prev(worker_arenas.end(), options.jobs); arena != worker_arenas.end(); ++arena)
+        threads.emplace_back(work, std::ref(*arena));
+    for (auto & thread : threads)
+        thread.join();
+
+    pending.clear();
+}
+
+void Comparison::place_field_type(TypeEntry & entry, FieldMatch & match, Section * previous)
+{
+    auto & type = *match.type;
+
+    if (!type.has_changes or !finds(Message_Field_Type_Changed))
+        return;
+
+    if (!match.section)
+    {
+        // Insert the field's section in order of fields.
+        auto & parent = *entry.section;
+        match.section = parent.arena->make<Section>(parent.arena, Message_Field_Comparison,
+                                                    match.field1->name(), match.field2->name());
+        parent.subsections.insert_after(previous, match.section);
+        parent.trimmed = false;
     }
 
-    return section;
+    auto & section = *match.section;
+
+    Item * item;
+    if (type.desc1)
+        item = section.arena->make<Item>(Message_Field_Type_Changed, type.desc1->full_name(), type.desc2->full_name());
+    else
+        item = section.arena->make<Item>(Message_Field_Type_Changed, type.enum1->full_name(), type.enum2->full_name());
+
+    if (!section.items.empty() and section.items.back().type == Message_Field_Default_Value_Changed)
+        section.items.insert(&section.items.back(), item);
+    else
+        section.items.push_back(item);
 }
 
-Comparison::Section * Comparison::compare(const Descriptor * desc1, const Descriptor * desc2)
+void Comparison::check_fingerprints(const TypeEntry & entry) const
 {
-    string key = desc1->full_name() + ":" + desc2->full_name();
-    if (compared.count(key))
-        return compared.at(key);
+    if (!entry.has_changes)
+        return;
 
-    auto & section = root.add_subsection(Message_Comparison, desc1->full_name(), desc2->full_name());
-    compared.emplace(key, &section);
+    bool equal = entry.desc1 ?
+                fingerprints.equal(entry.desc1, entry.desc2) :
+                fingerprints.equal(entry.enum1, entry.enum2);
 
+    if (equal)
+    {
+        throw std::runtime_error("Types with equal fingerprints differ: " +
+                                 string(entry.section->a) + " -> " + string(entry.section->b));
+    }
+}
 
-    for (int i = 0; i < desc1->field_count(); ++i)
+void Comparison::begin_placing(TypeEntry & entry, vector<PlaceFrame> & frames, vector<TypeEntry*> & stack)
+{
+    entry.placed = true;
+    entry.index = entry.low_link = stack.size();
+    root.subsections.push_back(entry.section);
+    root.trimmed = false;
+    stack.push_back(&entry);
+    frames.push_back({ &entry, 0 });
+}
+
+void Comparison::finish_placing(const vector<TypeEntry*> & members)
+{
+    // Each entry of a cycle refers to all others through its fields, so either
+    // all of them have changes, or none. The sections do not change apart from
+    // changes in types of fields, so decide once whether they are empty after trimming.
+    bool has_changes = false;
+
+    for (auto * entry : members)
     {
-        auto * field1 = desc1->field(i);
-        auto * field2 = options.binary ?
-                    desc2->FindFieldByNumber(field1->number()) :
-                    desc2->FindFieldByName(field1->name());
+        entry->section->trim();
+        has_changes |= !entry->section->is_empty();
 
-        if (field2)
+        for (auto & match : entry->fields)
+            has_changes |= match.field2 and match.type and match.type->has_changes and finds(Message_Field_Type_Changed);
+    }
+
+    for (auto * entry : members)
+    {
+        entry->has_changes = has_changes;
+        entry->complete = true;
+    }
+
+    for (auto * entry : members)
+    {
+        Section * previous = nullptr;
+        for (auto & match : entry->fields)
         {
-            section.subsections.push_back(compare(field1, field2));
+            if (match.field2 and match.type)
+                place_field_type(*entry, match, previous);
+            if (match.section)
+                previous = match.section;
         }
-        else
+
+        if (options.check_fingerprints)
+            check_fingerprints(*entry);
+    }
+}
+
+Comparison::Section * Comparison::place(TypeEntry & first)
+{
+    if (first.placed)
+        return first.section;
+
+    PhaseTimer timer(stats.place_time);
+
+    // Types of fields are placed depth-first, using an explicit stack
+    // so that long chains of referenced types do not exhaust the call stack.
+    // Types referring to each other in cycles are found by Tarjan's algorithm,
+    // and each cycle is completed as a whole once all other types it refers to are,
+    // so that the result does not depend on which type of a cycle is placed first.
+
+    vector<PlaceFrame> frames;
+    // Placed entries whose cycles are not complete yet.
+    vector<TypeEntry*> stack;
+    begin_placing(first, frames, stack);
+
+    while (!frames.empty())
+    {
+        auto & frame = frames.back();
+        auto & entry = *frame.entry;
+
+        if (frame.next_field < entry.fields.size())
         {
-            string field1_id = options.binary ? to_string(field1->number()) : field1->name();
-            section.add_item(Message_Field_Removed, field1_id, "");
+            auto & match = entry.fields[frame.next_field];
+
+            if (match.field2 and match.type)
+            {
+                auto & type = *match.type;
+
+                // Place the type first, then return to this field.
+                if (!type.placed)
+                {
+                    begin_placing(type, frames, stack);
+                    continue;
+                }
+
+                type.section->add_reference(match.field1, match.field2, options.max_references);
+
+                if (!type.complete)
+                    entry.low_link = std::min(entry.low_link, type.index);
+            }
+
+            ++frame.next_field;
+            continue;
+        }
+
+        frames.pop_back();
+
+        if (!frames.empty())
+        {
+            auto & parent = *frames.back().entry;
+            parent.low_link = std::min(parent.low_link, entry.low_link);
         }
+
+        if (entry.low_link != entry.index)
+            continue;
+
+        vector<TypeEntry*> members;
+        TypeEntry * member;
+        do
+        {
+            member = stack.back();
+            stack.pop_back();
+            members.push_back(member);
+        }
+        while (member != &entry);
+
+        finish_placing(members);
     }
 
-    for (int i = 0; i < desc2->field_count(); ++i)
-    {
-        auto * field2 = desc2->field(i);
-        auto * field1 =  options.binary ?
-                    desc1->FindFieldByNumber(field2->number()) :
-                    desc1->FindFieldByName(field2->name());
+    return first.section;
+}
 
-        if (!field1)
+Comparison::Section * Comparison::compare(const EnumDescriptor * enum1, const EnumDescriptor * enum2)
+{
+    auto result = compared.insert(enum1, enum2);
+    if (result.second)
+    {
+        if (use_fingerprints())
         {
-            string field2_id = options.binary ? to_string(field2->number()) : field2->name();
-            section.add_item(Message_Field_Added, "", field2_id);
+            PhaseTimer timer(stats.walk_time);
+            fingerprints.add(enum1);
+            fingerprints.add(enum2);
         }
+        pending.push_back(result.first);
+        compare_pending();
     }
+    if (options.verdict_only)
+        return nullptr;
+    return place(*result.first);
+}
 
-    return &section;
+Comparison::Section * Comparison::compare(const Descriptor * desc1, const Descriptor * desc2)
+{
+    auto result = compared.insert(desc1, desc2);
+    if (result.second)
+    {
+        if (use_fingerprints())
+        {
+            PhaseTimer timer(stats.walk_time);
+            fingerprints.add(desc1);
+            fingerprints.add(desc2);
+        }
+        pending.push_back(result.first);
+        compare_pending();
+    }
+    if (options.verdict_only)
+        return nullptr;
+    return place(*result.first);
 }
 
 void Comparison::compare(Source & source1, Source & source2)
 {
-    auto * file1 = source1.file_descriptor();
-    auto * file2 = source2.file_descriptor();
+    compare(source1.file_descriptor(), source2.file_descriptor());
+}
 
-    for (int i = 0; i < file1->message_type_count(); ++i)
+// Access to types declared in files and in messages.
+
+static int message_count(const FileDescriptor * file) { return file->message_type_count(); }
+static const Descriptor * message(const FileDescriptor * file, int i) { return file->message_type(i); }
+static const Descriptor * find_message(const FileDescriptor * file, const string & name)
+{ return file->FindMessageTypeByName(name); }
+
+static int message_count(const Descriptor * desc) { return desc->nested_type_count(); }
+static const Descriptor * message(const Descriptor * desc, int i) { return desc->nested_type(i); }
+static const Descriptor * find_message(const Descriptor * desc, const string & name)
+{ return desc->FindNestedTypeByName(name); }
+
+template <typename Scope>
+void Comparison::compare_declared(const Scope * scope1, const Scope * scope2,
+                                  vector<TypeEntry*> & entries, vector<MessagePair> & matched,
+                                  vector<DeclaredType> & declared)
+{
+    for (int i = 0; i < message_count(scope1); ++i)
     {
-        auto * msg1 = file1->message_type(i);
-        auto * msg2 = file2->FindMessageTypeByName(msg1->name());
+        auto * msg1 = message(scope1, i);
+        auto * msg2 = find_message(scope2, msg1->name());
+        declared.push_back({ msg1, msg2, nullptr, nullptr });
         if (msg2)
         {
-            compare(msg1, msg2);
+            matched.emplace_back(msg1, msg2);
+
+            // Messages without items to find are not walked, but their nested types are.
+            if (!compares_messages())
+                continue;
+
+            if (use_fingerprints())
+            {
+                fingerprints.add(msg1);
+                fingerprints.add(msg2);
+            }
+            if (identical(msg1, msg2))
+            {
+                ++skipped_types;
+                continue;
+            }
+
+            auto result = compared.insert(msg1, msg2);
+            if (result.second)
+                pending.push_back(result.first);
+            entries.push_back(result.first);
         }
-        else
+        else if (finds(File_Message_Removed))
         {
             root.add_item(File_Message_Removed, msg1->full_name(), "");
         }
     }
 
-    for (int i = 0; i < file2->message_type_count(); ++i)
+    for (int i = 0; i < message_count(scope2); ++i)
     {
-        auto * msg2 = file2->message_type(i);
-        auto * msg1 = file1->FindMessageTypeByName(msg2->name());
+        auto * msg2 = message(scope2, i);
+        auto * msg1 = find_message(scope1, msg2->name());
         if (!msg1)
         {
-            root.add_item(File_Message_Added, "", msg2->full_name());
+            declared.push_back({ nullptr, msg2, nullptr, nullptr });
+            if (finds(File_Message_Added))
+                root.add_item(File_Message_Added, "", msg2->full_name());
         }
     }
 
-    for (int i = 0; i < file1->enum_type_count(); ++i)
+    for (int i = 0; i < scope1->enum_type_count(); ++i)
     {
-        auto * enum1 = file1->enum_type(i);
-        auto * enum2 = file2->FindEnumTypeByName(enum1->name());
+        auto * enum1 = scope1->enum_type(i);
+        auto * enum2 = scope2->FindEnumTypeByName(enum1->name());
+        declared.push_back({ nullptr, nullptr, enum1, enum2 });
         if (enum2)
         {
-            compare(enum1, enum2);
+            if (!compares_values())
+                continue;
+
+            if (use_fingerprints())
+            {
+                fingerprints.add(enum1);
+                fingerprints.add(enum2);
+            }
+            if (identical(enum1, enum2))
+            {
+                ++skipped_types;
+                continue;
+            }
+
+            auto result = compared.insert(enum1, enum2);
+            if (result.second)
+                pending.push_back(result.first);
+            entries.push_back(result.first);
         }
-        else
+        else if (finds(File_Enum_Removed))
         {
             root.add_item(File_Enum_Removed, enum1->full_name(), "");
         }
     }
 
-    for (int i = 0; i < file2->enum_type_count(); ++i)
+    for (int i = 0; i < scope2->enum_type_count(); ++i)
     {
-        auto * enum2 = file2->enum_type(i);
-        auto * enum1 = file1->FindEnumTypeByName(enum2->name());
+        auto * enum2 = scope2->enum_type(i);
+        auto * enum1 = scope1->FindEnumTypeByName(enum2->name());
         if (!enum1)
         {
-            root.add_item(File_Enum_Added, "", enum2->full_name());
+            declared.push_back({ nullptr, nullptr, nullptr, enum2 });
+            if (finds(File_Enum_Added))
+                root.add_item(File_Enum_Added, "", enum2->full_name());
+        }
+    }
+}
+
+void Comparison::compare_files(const FileDescriptor * file1, const FileDescriptor * file2,
+                               vector<TypeEntry*> & entries, vector<DeclaredType> & declared)
+{
+    PhaseTimer timer(stats.walk_time);
+
+    compared.reserve(compared.size() + type_count(file1));
+
+    if (use_fingerprints())
+        fingerprints.reserve(type_count(file1) + type_count(file2));
+
+    vector<MessagePair> matched;
+
+    compare_declared(file1, file2, entries, matched, declared);
+
+    // Types nested in matching messages follow those of the file,
+    // each message's before those of the next one. They are visited
+    // using an explicit stack, as messages may be nested deeply.
+
+    vector<MessagePair> scopes;
+
+    while (options.nested_types)
+    {
+        scopes.insert(scopes.end(), matched.rbegin(), matched.rend());
+        matched.clear();
+
+        if (scopes.empty())
+            break;
+
+        auto scope = scopes.back();
+        scopes.pop_back();
+
+        compare_declared(scope.first, scope.second, entries, matched, declared);
+    }
+}
+
+void Comparison::compare(const FileDescriptor * file1, const FileDescriptor * file2)
+{
+    // Compare all types up front, so they can be compared in parallel,
+    // then place them in the order of the files.
+
+    vector<TypeEntry*> entries;
+    vector<DeclaredType> declared;
+
+    compare_files(file1, file2, entries, declared);
+
+    if (has_breaking_items(root))
+        found_breaking = true;
+
+    compare_pending();
+
+    if (options.verdict_only)
+        return;
+
+    for (auto * entry : entries)
+    {
+        place(*entry);
+    }
+}
+
+void Comparison::propagate_breaking()
+{
+    // Breaking changes are found from the types they are in
+    // to the types referring to them, so cycles are visited once.
+
+    unordered_map<TypeEntry*, vector<TypeEntry*>> referrers;
+    vector<TypeEntry*> breaking;
+
+    compared.for_each([&](TypeEntry & entry)
+    {
+        for (auto & match : entry.fields)
+        {
+            if (match.type)
+                referrers[match.type].push_back(&entry);
+        }
+        if (entry.breaking)
+            breaking.push_back(&entry);
+    });
+
+    while (!breaking.empty())
+    {
+        auto * entry = breaking.back();
+        breaking.pop_back();
+
+        for (auto * referrer : referrers[entry])
+        {
+            if (!referrer->breaking)
+            {
+                referrer->breaking = true;
+                breaking.push_back(referrer);
+            }
         }
     }
 }
 
+vector<Comparison::TypeResult> Comparison::compare_types(const FileDescriptor * file1, const FileDescriptor * file2)
+{
+    types_only = true;
+
+    vector<TypeEntry*> entries;
+    vector<DeclaredType> declared;
+
+    compare_files(file1, file2, entries, declared);
+    compare_pending();
+    propagate_breaking();
+
+    types_only = false;
+
+    bool removed_breaking = is_breaking(File_Message_Removed, options.binary) and finds(File_Message_Removed);
+
+    vector<TypeResult> results;
+    results.reserve(declared.size());
+
+    for (auto & type : declared)
+    {
+        const void * type1 = type.desc1 ? static_cast<const void*>(type.desc1) : type.enum1;
+        const void * type2 = type.desc2 ? static_cast<const void*>(type.desc2) : type.enum2;
+        string_view name1 = type.desc1 ? type.desc1->full_name() : type.enum1 ? type.enum1->full_name() : string_view();
+        string_view name2 = type.desc2 ? type.desc2->full_name() : type.enum2 ? type.enum2->full_name() : string_view();
+
+        if (!type1)
+        {
+            results.push_back({ name2, Type_Added });
+        }
+        else if (!type2)
+        {
+            results.push_back({ name1, Type_Removed });
+            if (removed_breaking)
+                found_breaking = true;
+        }
+        else
+        {
+            // Identical types are not compared at all.
+            auto * entry = compared.find(type1, type2);
+            results.push_back({ name2, entry and entry->breaking ? Type_Breaking : Type_Compatible });
+        }
+    }
+
+    return results;
+}
 
 void Comparison::compare(Source & source1, const string & name1, Source & source2, const string &name2)
 {
@@ -432,7 +1382,7 @@ void Comparison::compare(Source & source1, const string & name1, Source & source
     }
     else
     {
-        root.add_item(Name_Missing, name1, name2);
+        root.add_item(Name_Missing, names.intern(name1), names.intern(name2));
+        found_breaking = true;
     }
 }
-
@@ -1,72 +1,35 @@
-#include <google/protobuf/compiler/importer.h>
+#pragma once
+
 #include <google/protobuf/descriptor.h>
 
+#include "arena.h"
+#include "fingerprint.h"
+#include "source.h"
+#include "statistics.h"
+
 #include <iostream>
 #include <sstream>
 #include <memory>
 #include <list>
 #include <unordered_map>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <atomic>
 
 using std::string;
+using std::string_view;
 using std::list;
-using std::shared_ptr;
 using std::unordered_map;
+using std::vector;
 
 using google::protobuf::Descriptor;
 using google::protobuf::FieldDescriptor;
 using google::protobuf::EnumDescriptor;
+using google::protobuf::EnumValueDescriptor;
+using google::protobuf::FileDescriptor;
 
-class ErrorCollector : public google::protobuf::compiler::MultiFileErrorCollector
-{
-public:
-    ErrorCollector() {}
-
-    void AddError(const std::string & filename, int line, int column, const std::string & message) override
-    {
-        using namespace std;
-        cerr << "Error: " << filename << "@" << line << "," << column << ": " << message << endl;
-    }
-
-    void AddWarning(const std::string & filename, int line, int column, const std::string & message) override
-    {
-        using namespace std;
-        cerr << "Warning: " << filename << "@" << line << "," << column << ": " << message << endl;
-    }
-};
-
-class Source
-{
-    using DiskSourceTree = google::protobuf::compiler::DiskSourceTree;
-    using Importer = google::protobuf::compiler::Importer;
-    using DescriptorPool = google::protobuf::DescriptorPool;
-    using FileDescriptor = google::protobuf::FileDescriptor;
-
-public:
-    Source() {}
-    Source(const string & file_path, const string & root_dir)
-    {
-        source_tree.MapPath("", root_dir);
-
-        ErrorCollector error_collector;
-
-        importer = std::make_shared<Importer>(&source_tree, &error_collector);
-
-        d_file_descriptor = importer->Import(file_path);
-        if (!d_file_descriptor)
-        {
-            throw std::runtime_error("Failed to load source.");
-        }
-    }
-
-    const FileDescriptor * file_descriptor() const { return d_file_descriptor; }
-    const DescriptorPool * pool() const { return importer->pool(); }
-
-private:
-    DiskSourceTree source_tree;
-    ErrorCollector error_collector;
-    shared_ptr<Importer> importer;
-    const FileDescriptor * d_file_descriptor = nullptr;
-};
+class Reporter;
 
 class Comparison
 {
@@ -91,13 +54,26 @@ public:
         Name_Missing
     };
 
+    // A set of item types, as bits shifted by the type.
+    using ItemTypes = uint32_t;
+
+    static constexpr ItemTypes item_bit(ItemType type) { return ItemTypes(1) << type; }
+    static constexpr ItemTypes All_Items = (ItemTypes(1) << (Name_Missing + 1)) - 1;
+
+    // Items, sections and references refer to text owned by the descriptor pools
+    // or by the comparison's name table, which holds one copy of each other name and number,
+    // so they are cheap to create, and equal names not owned by descriptors share their text.
+
     struct Item
     {
-        Item(ItemType t, const string & a, const string & b): type(t), a(a), b(b) {}
+        Item(ItemType t, string_view a, string_view b): type(t), a(a), b(b) {}
         ItemType type;
-        string a;
-        string b;
+        string_view a;
+        string_view b;
 
+        Item * next = nullptr;
+
+        void write(std::ostream & out) const;
         string message() const;
     };
 
@@ -110,69 +86,386 @@ public:
         Enum_Value_Comparison
     };
 
+    // A pair of fields whose types are compared in a section, by full name.
+    struct Reference
+    {
+        Reference(string_view a, string_view b): a(a), b(b) {}
+        string_view a;
+        string_view b;
+
+        Reference * next = nullptr;
+
+        void write(std::ostream & out) const;
+        string message() const;
+    };
+
     struct Section
     {
-        Section(SectionType t, const string & a, const string & b):
-            type(t), a(a), b(b) {}
+        Section(Arena * arena, SectionType t, string_view a, string_view b):
+            type(t), a(a), b(b), arena(arena) {}
 
         SectionType type;
-        string a;
-        string b;
+        string_view a;
+        string_view b;
+
+        // Only the first references are kept if their number is limited.
+        Chain<Reference> references;
+        size_t reference_count = 0;
+        Chain<Section> subsections;
+        Chain<Item> items;
+
+        // Allocates the subsections, items and references.
+        Arena * arena;
 
-        list<string> notes;
-        list<Section> subsections;
-        list<Item> items;
+        Section * next = nullptr;
 
-        Section & add_subsection(SectionType t, const string & a, const string & b)
+        // Whether trim() was applied since subsections were last added,
+        // so sections of types referenced many times are trimmed only once.
+        // Must be reset when adding to subsections directly.
+        bool trimmed = false;
+
+        Section & add_subsection(SectionType t, string_view a, string_view b)
         {
-            subsections.emplace_back(t, a, b);
-            return subsections.back();
+            auto * subsection = arena->make<Section>(arena, t, a, b);
+            subsections.push_back(subsection);
+            trimmed = false;
+            return *subsection;
         }
 
-        void add_item(ItemType t, const string & a, const string & b)
+        void add_item(ItemType t, string_view a, string_view b)
         {
-            items.emplace_back(t, a, b);
+            items.push_back(arena->make<Item>(t, a, b));
+        }
+
+        // Keeps at most max_references references, unless it is 0.
+        void add_reference(const FieldDescriptor * field1, const FieldDescriptor * field2,
+                           size_t max_references = 0)
+        {
+            ++reference_count;
+            if (!max_references or references.size() < max_references)
+                references.push_back(arena->make<Reference>(field1->full_name(), field2->full_name()));
         }
 
         bool is_empty() const { return subsections.empty() and items.empty(); }
 
         void trim()
         {
-            auto s = subsections.begin();
-            while (s != subsections.end())
+            if (trimmed)
+                return;
+
+            subsections.remove_if([](Section & s)
             {
-                s->trim();
-                if (s->is_empty())
-                    s = subsections.erase(s);
-                else
-                    ++s;
-            }
+                s.trim();
+                return s.is_empty();
+            });
+
+            trimmed = true;
         }
 
+        void write(std::ostream & out) const;
         string message() const;
 
-        void print(int level = 0);
+        // Reports this section and its contents in order of output.
+        void report(Reporter & reporter) const;
+        void print(int level = 0) const;
     };
 
     struct Options
     {
         Options() {}
         bool binary = false;
+        // Number of threads comparing message and enum types.
+        int jobs = 1;
+        // Maximum number of fields listed as requiring a type, or 0 for all.
+        size_t max_references = 0;
+        // Skip comparing types with equal fingerprints, which have no differences.
+        bool skip_identical = true;
+        // Compare types with equal fingerprints anyway, and fail if they differ.
+        bool check_fingerprints = false;
+        // Compare types nested in messages, in addition to top-level types of files.
+        bool nested_types = true;
+        // Only decide whether there are breaking changes, without a result to report.
+        // Stops at the first breaking change, and keeps no sections of compared types.
+        bool verdict_only = false;
+        // Count sections and items of the result before and after trimming, for statistics().
+        bool statistics = false;
+        // Types of items to find. Checks and types that can only find others are skipped,
+        // and a field's type changes only if the type has items to find. Items of missing names are always found.
+        ItemTypes items = All_Items;
+    };
+
+    // Compatibility of a type declared in compared files.
+    enum TypeStatus
+    {
+        Type_Compatible,
+        Type_Breaking,
+        Type_Added,
+        Type_Removed
     };
 
-    Comparison(const Options & options = Options{});
+    struct TypeResult
+    {
+        // Full name in the second file, or in the first one if removed.
+        string_view name;
+        TypeStatus status;
+    };
+
+    // Fingerprints and sorted fields and values of all types of a file and its imports,
+    // computed once to compare the file with many others. Comparisons only read it,
+    // so it can be shared by comparisons in any number of threads.
+    class Baseline
+    {
+    public:
+        Baseline(const FileDescriptor * file, const Options & options = Options{});
+
+        template <typename Key>
+        using Keys = vector<std::pair<Key, int>>;
+
+        // Fields or values of the type and their indexes, sorted by number in binary mode
+        // and by name otherwise, or null if not known.
+        const Keys<int> * numbers(const void * type) const;
+        const Keys<string_view> * names(const void * type) const;
+
+    private:
+        friend class Comparison;
+
+        bool binary;
+        Fingerprints fingerprints;
+        unordered_map<const void*, Keys<int>> sorted_numbers;
+        unordered_map<const void*, Keys<string_view>> sorted_names;
+    };
+
+private:
+    struct TypeEntry;
+
+    // A field of the first message type and its match in the second one.
+    struct FieldMatch
+    {
+        const FieldDescriptor * field1 = nullptr;
+        // Null if the field was removed.
+        const FieldDescriptor * field2 = nullptr;
+        // Null until there are differences.
+        Section * section = nullptr;
+        // Comparison of field types, if both are messages or enums.
+        TypeEntry * type = nullptr;
+    };
+
+    // A compared pair of message or enum types.
+    struct TypeEntry
+    {
+        const Descriptor * desc1 = nullptr;
+        const Descriptor * desc2 = nullptr;
+        const EnumDescriptor * enum1 = nullptr;
+        const EnumDescriptor * enum2 = nullptr;
+
+        Section * section = nullptr;
+
+        // Removed fields, and matched fields with differences or with types to compare.
+        vector<FieldMatch> fields;
+
+        // Whether the section has breaking items, apart from changes in types of fields.
+        // Also whether the types of fields have them, done by compare_types().
+        bool breaking = false;
+
+        bool placed = false;
+        // Set once the types of all its fields are complete, or in the same cycle.
+        bool complete = false;
+        // Whether the section is not empty after trimming, once complete.
+        bool has_changes = false;
+        // While being placed, its position on the stack of incomplete entries,
+        // and the lowest position of those reachable from it.
+        size_t index = 0;
+        size_t low_link = 0;
+    };
+
+public:
+    // Thread-safe map of compared type pairs.
+    class Memo
+    {
+    public:
+        // Returns the entry for the given types, and whether it was just created.
+        std::pair<TypeEntry*, bool> insert(const Descriptor * desc1, const Descriptor * desc2);
+        std::pair<TypeEntry*, bool> insert(const EnumDescriptor * enum1, const EnumDescriptor * enum2);
+
+        // The entry for the given types, or null if they were not compared.
+        TypeEntry * find(const void * type1, const void * type2);
+
+        template <typename Function>
+        void for_each(Function function)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto & entry : entries)
+                function(entry.second);
+        }
+
+        void reserve(size_t count);
+        size_t size();
+
+        // Number of lookups which found an existing entry or created one.
+        size_t hits();
+        size_t misses();
+
+    private:
+        // Descriptors are owned by their pools, so their addresses identify them.
+        using Key = std::pair<const void*, const void*>;
+
+        struct KeyHash
+        {
+            size_t operator()(const Key & key) const
+            {
+                size_t h1 = std::hash<const void*>()(key.first);
+                size_t h2 = std::hash<const void*>()(key.second);
+                return h1 ^ (h2 + 0x9e3779b97f4a7c15 + (h1 << 6) + (h1 >> 2));
+            }
+        };
+
+        std::mutex mutex;
+        unordered_map<Key, TypeEntry, KeyHash> entries;
+        size_t hit_count = 0;
+        size_t miss_count = 0;
+    };
+
+    // Whether items of the type break compatibility of serialized data. Numbers of fields
+    // and enum values always matter, and in JSON mode, when 'binary' is false, so do renames.
+    static bool is_breaking(ItemType type, bool binary);
+    // Types of items which break compatibility, as decided by is_breaking().
+    static ItemTypes breaking_items(bool binary);
+
+    // Number of message and enum types, including nested ones,
+    // in the file and all its dependencies.
+    static size_t type_count(const FileDescriptor * file);
+
+    // Uses the fingerprints and sorted fields and values of the baseline's types, if given.
+    Comparison(const Options & options = Options{}, const Baseline * baseline = nullptr);
+
+    // Trims the result and reports it.
+    void report(Reporter & reporter);
+
+    // Whether any compared type pair or file has breaking items, apart from changes of
+    // field types due to changes in the referenced types, which are breaking on their own.
+    bool breaking() const { return found_breaking; }
+
+    // Timings and counts of the comparison so far, apart from loading sources.
+    Statistics statistics();
 
     void compare(Source & source1, Source & source2);
+    void compare(const FileDescriptor * file1, const FileDescriptor * file2);
+    // Compares all types of the files, but only decides whether each type declared in them
+    // has breaking changes, including those of the types its fields refer to, without a result.
+    // Types are listed in the order of comparison, removed ones as they are found.
+    vector<TypeResult> compare_types(const FileDescriptor * file1, const FileDescriptor * file2);
     void compare(Source & source1, const string & name1, Source & source2, const string &name2);
     Section * compare(const EnumDescriptor * enum1, const EnumDescriptor * enum2);
     Section * compare(const Descriptor * desc1, const Descriptor * desc2);
-    Section compare(const FieldDescriptor * field1, const FieldDescriptor * field2);
+    // Compares properties of the fields themselves, without comparing their types.
+    // Adds a subsection to parent and returns it only if there are differences.
+    Section * compare(const FieldDescriptor * field1, const FieldDescriptor * field2, Section & parent);
     bool compare_default_value(const FieldDescriptor * field1, const FieldDescriptor * field2);
 
-    Section root { Root_Section, "", "" };
+    // Prepares for comparing the given number of type pairs without rehashing.
+    void reserve(size_t type_count) { compared.reserve(type_count); }
+
+    // Names and numbers of items, shared by the arenas of all threads.
+    NameTable names;
 
-    unordered_map<string, Section*> compared;
+    Arena arena;
+
+    Section root { &arena, Root_Section, "", "" };
+
+    Memo compared;
 
 private:
+    // Compares the types of all entries pending in the queue,
+    // including the types they refer to, in parallel if requested.
+    void compare_pending();
+    // Fills in the entry's section, apart from changes in types of fields.
+    void compare_entry(TypeEntry & entry, vector<TypeEntry*> & discovered, Arena & arena);
+    void compare_fields(TypeEntry & entry, vector<TypeEntry*> & discovered, Arena & arena);
+    void compare_values(TypeEntry & entry, Arena & arena);
+    // Adds the entry's section to the root section and resolves changes
+    // in types of its fields, in the same order as a depth-first comparison.
+    Section * place(TypeEntry & entry);
+    // Adds a type change to the field, after the previous field's section, if its type has changes.
+    void place_field_type(TypeEntry & entry, FieldMatch & match, Section * previous);
+
+    using MessagePair = std::pair<const Descriptor*, const Descriptor*>;
+
+    // A type declared in either file, and its match in the other one, if any.
+    struct DeclaredType
+    {
+        const Descriptor * desc1;
+        const Descriptor * desc2;
+        const EnumDescriptor * enum1;
+        const EnumDescriptor * enum2;
+    };
+
+    // Compares the types declared in two files or two messages, and reports
+    // added and removed ones. Collects the matching messages, whose nested
+    // types are still to compare, the entries to place in order, and all declared types.
+    template <typename Scope>
+    void compare_declared(const Scope * scope1, const Scope * scope2,
+                          vector<TypeEntry*> & entries, vector<MessagePair> & matched,
+                          vector<DeclaredType> & declared);
+    // Compares the types declared in the files, and those nested in them if requested.
+    void compare_files(const FileDescriptor * file1, const FileDescriptor * file2,
+                       vector<TypeEntry*> & entries, vector<DeclaredType> & declared);
+    // Marks entries referring to types with breaking changes as breaking.
+    void propagate_breaking();
+
+    // An entry being placed, and the next of its fields to place.
+    struct PlaceFrame
+    {
+        TypeEntry * entry;
+        size_t next_field;
+    };
+
+    void begin_placing(TypeEntry & entry, vector<PlaceFrame> & frames, vector<TypeEntry*> & stack);
+    // Decides whether the entries of a cycle, or a single entry, have changes, together.
+    void finish_placing(const vector<TypeEntry*> & members);
+
+    bool has_breaking_items(const Section & section) const;
+    bool stopped() const { return options.verdict_only and found_breaking; }
+    // Whether sections of compared types are kept for the result.
+    bool keep_sections() const { return !options.verdict_only and !types_only; }
+
+    bool use_fingerprints() const { return options.skip_identical or options.check_fingerprints; }
+
+    bool finds(ItemType type) const { return options.items & item_bit(type); }
+    // Whether comparing values of enums, or fields of messages and the types they refer to, can find any items.
+    bool compares_values() const;
+    bool compares_messages() const;
+
+    bool identical(const Descriptor * desc1, const Descriptor * desc2) const
+    {
+        return options.skip_identical and !options.check_fingerprints and fingerprints.equal(desc1, desc2);
+    }
+
+    bool identical(const EnumDescriptor * enum1, const EnumDescriptor * enum2) const
+    {
+        return options.skip_identical and !options.check_fingerprints and fingerprints.equal(enum1, enum2);
+    }
+
+    // Throws if the complete entry has changes despite equal fingerprints.
+    void check_fingerprints(const TypeEntry & entry) const;
+
     Options options;
+    const Baseline * baseline;
+    // Set while comparing by compare_types().
+    bool types_only = false;
+    // Computed before comparing, if identical types are skipped or checked.
+    Fingerprints fingerprints;
+    vector<TypeEntry*> pending;
+    // Arenas of worker threads.
+    list<Arena> worker_arenas;
+    // Holds the sections of one type pair at a time, if there is no result to report.
+    Arena scratch;
+    std::atomic<bool> found_breaking { false };
+
+    // Phase timings, and counts of sections and items if requested.
+    Statistics stats;
+    // Counted by the threads comparing type pairs.
+    std::atomic<size_t> visited_types { 0 };
+    std::atomic<size_t> skipped_types { 0 };
+    std::atomic<size_t> visited_fields { 0 };
+    std::atomic<size_t> visited_values { 0 };
 };
@@ -0,0 +1,304 @@
+#include "fingerprint.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+using google::protobuf::FieldDescriptor;
+
+namespace {
+
+template <typename T>
+uint64_t bits(T value)
+{
+    static_assert(sizeof(T) <= sizeof(uint64_t), "Value too large");
+    uint64_t result = 0;
+    memcpy(&result, &value, sizeof(T));
+    return result;
+}
+
+// Adds the properties of the field compared by Comparison::compare(field1, field2, parent).
+// Returns false if the default value never equals itself.
+bool add_field(Hash & hash, const FieldDescriptor * field)
+{
+    hash.add(field->name());
+    hash.add(uint64_t(field->number()));
+    hash.add(uint64_t(field->label()));
+    hash.add(uint64_t(field->type()));
+    hash.add(uint64_t(field->has_default_value()));
+
+    if (!field->has_default_value())
+        return true;
+
+    switch(field->cpp_type())
+    {
+    case FieldDescriptor::CPPTYPE_INT32:
+        hash.add(bits(field->default_value_int32())); break;
+    case FieldDescriptor::CPPTYPE_INT64:
+        hash.add(bits(field->default_value_int64())); break;
+    case FieldDescriptor::CPPTYPE_UINT32:
+        hash.add(bits(field->default_value_uint32())); break;
+    case FieldDescriptor::CPPTYPE_UINT64:
+        hash.add(bits(field->default_value_uint64())); break;
+    case FieldDescriptor::CPPTYPE_FLOAT:
+        if (field->default_value_float() != field->default_value_float())
+            return false;
+        hash.add(bits(field->default_value_float())); break;
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+        if (field->default_value_double() != field->default_value_double())
+            return false;
+        hash.add(bits(field->default_value_double())); break;
+    case FieldDescriptor::CPPTYPE_BOOL:
+        hash.add(uint64_t(field->default_value_bool())); break;
+    case FieldDescriptor::CPPTYPE_STRING:
+        hash.add(field->default_value_string()); break;
+    case FieldDescriptor::CPPTYPE_ENUM:
+        hash.add(bits(field->default_value_enum()->number())); break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+}
+
+void Fingerprints::add(const EnumDescriptor * enum_desc)
+{
+    if (find(enum_desc))
+        return;
+
+    Fingerprint fingerprint;
+    Hash hash;
+    hash.add("enum");
+    hash.add(uint64_t(enum_desc->value_count()));
+
+    // Values are looked up by number in binary comparisons,
+    // so aliases make an enum appear changed compared to itself.
+    unordered_set<int> numbers;
+
+    for (int i = 0; i < enum_desc->value_count(); ++i)
+    {
+        auto * value = enum_desc->value(i);
+        hash.add(value->name());
+        hash.add(bits(value->number()));
+        if (!numbers.insert(value->number()).second)
+            fingerprint.valid = false;
+    }
+
+    fingerprint.hash = hash.value();
+    fingerprints.emplace(enum_desc, fingerprint);
+}
+
+void Fingerprints::add(const Descriptor * root)
+{
+    if (find(root))
+        return;
+
+    // Message types may refer to each other in cycles. Fingerprints of types
+    // in a cycle are computed together, once those of all other types they refer to
+    // are known. Cycles are found by Tarjan's algorithm, using explicit stacks
+    // instead of recursion, as the chains of types may be long.
+
+    struct Node
+    {
+        int index;
+        int low_link;
+        bool on_stack;
+    };
+
+    struct Frame
+    {
+        const Descriptor * desc;
+        int next_field;
+    };
+
+    unordered_map<const Descriptor*, Node> nodes;
+    vector<const Descriptor*> stack;
+    vector<Frame> frames;
+
+    auto visit = [&](const Descriptor * desc)
+    {
+        int index = nodes.size();
+        nodes.emplace(desc, Node { index, index, true });
+        stack.push_back(desc);
+        frames.push_back({ desc, 0 });
+    };
+
+    visit(root);
+
+    while (!frames.empty())
+    {
+        auto * desc = frames.back().desc;
+
+        if (frames.back().next_field < desc->field_count())
+        {
+            auto * field = desc->field(frames.back().next_field++);
+
+            if (field->type() == FieldDescriptor::TYPE_ENUM)
+            {
+                add(field->enum_type());
+            }
+            else if (field->type() == FieldDescriptor::TYPE_MESSAGE)
+            {
+                auto * type = field->message_type();
+                if (find(type))
+                    continue;
+
+                auto node = nodes.find(type);
+                if (node == nodes.end())
+                    visit(type);
+                else if (node->second.on_stack)
+                    nodes[desc].low_link = std::min(nodes[desc].low_link, node->second.index);
+            }
+
+            continue;
+        }
+
+        frames.pop_back();
+
+        auto & node = nodes[desc];
+        if (!frames.empty())
+        {
+            auto & parent = nodes[frames.back().desc];
+            parent.low_link = std::min(parent.low_link, node.low_link);
+        }
+
+        if (node.low_link != node.index)
+            continue;
+
+        vector<const Descriptor*> members;
+        const Descriptor * member;
+        do
+        {
+            member = stack.back();
+            stack.pop_back();
+            nodes[member].on_stack = false;
+            members.push_back(member);
+        }
+        while (member != desc);
+
+        add_component(members);
+    }
+}
+
+void Fingerprints::add_component(vector<const Descriptor*> & members)
+{
+    unordered_set<const Descriptor*> cycle(members.begin(), members.end());
+
+    bool cyclic = members.size() > 1;
+    for (int i = 0; !cyclic and i < members[0]->field_count(); ++i)
+    {
+        auto * field = members[0]->field(i);
+        cyclic = field->type() == FieldDescriptor::TYPE_MESSAGE and field->message_type() == members[0];
+    }
+
+    // Types in the same cycle are identified by name,
+    // and other types by their fingerprints.
+    auto add_message = [&](Hash & hash, const Descriptor * desc)
+    {
+        bool valid = true;
+
+        hash.add("message");
+        hash.add(uint64_t(desc->field_count()));
+
+        for (int i = 0; i < desc->field_count(); ++i)
+        {
+            auto * field = desc->field(i);
+            valid &= add_field(hash, field);
+
+            const void * type = nullptr;
+            if (field->type() == FieldDescriptor::TYPE_ENUM)
+                type = field->enum_type();
+            else if (field->type() == FieldDescriptor::TYPE_MESSAGE)
+                type = field->message_type();
+
+            if (!type)
+                continue;
+
+            if (field->type() == FieldDescriptor::TYPE_MESSAGE and cycle.count(field->message_type()))
+            {
+                hash.add(field->message_type()->full_name());
+            }
+            else
+            {
+                auto * fingerprint = find(type);
+                hash.add(fingerprint->hash);
+                valid &= fingerprint->valid;
+            }
+        }
+
+        return valid;
+    };
+
+    if (!cyclic)
+    {
+        Hash hash;
+        Fingerprint fingerprint;
+        fingerprint.valid = add_message(hash, members[0]);
+        fingerprint.hash = hash.value();
+        fingerprints.emplace(members[0], fingerprint);
+        return;
+    }
+
+    std::sort(members.begin(), members.end(), [](const Descriptor * a, const Descriptor * b)
+    {
+        return a->full_name() < b->full_name();
+    });
+
+    Hash hash;
+    bool valid = true;
+    hash.add("cycle");
+    for (auto * member : members)
+    {
+        hash.add(member->full_name());
+        valid &= add_message(hash, member);
+    }
+
+    for (auto * member : members)
+    {
+        Hash member_hash;
+        member_hash.add(hash.value());
+        member_hash.add(member->full_name());
+
+        Fingerprint fingerprint;
+        fingerprint.hash = member_hash.value();
+        fingerprint.valid = valid;
+        fingerprints.emplace(member, fingerprint);
+    }
+}
+
+const Fingerprints::Fingerprint * Fingerprints::find(const void * type) const
+{
+    auto fingerprint = fingerprints.find(type);
+    if (fingerprint != fingerprints.end())
+        return &fingerprint->second;
+
+    return base ? base->find(type) : nullptr;
+}
+
+bool Fingerprints::equal(const void * type1, const void * type2) const
+{
+    auto * fingerprint1 = find(type1);
+    auto * fingerprint2 = find(type2);
+
+    if (!fingerprint1 or !fingerprint2)
+        return false;
+
+    return fingerprint1->valid and fingerprint2->valid and
+            fingerprint1->hash == fingerprint2->hash;
+}
+
+bool Fingerprints::equal(const Descriptor * desc1, const Descriptor * desc2) const
+{
+    return equal(static_cast<const void*>(desc1), static_cast<const void*>(desc2));
+}
+
+bool Fingerprints::equal(const EnumDescriptor * enum1, const EnumDescriptor * enum2) const
+{
+    return equal(static_cast<const void*>(enum1), static_cast<const void*>(enum2));
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <google/protobuf/descriptor.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Structural hashes of message and enum types, covering everything compared
+// about them, including the types of their fields transitively.
+// Types with equal fingerprints have no differences, so comparing them can be skipped.
+class Fingerprints
+{
+public:
+    using Descriptor = google::protobuf::Descriptor;
+    using EnumDescriptor = google::protobuf::EnumDescriptor;
+
+    // Fingerprints of the base are used as if they were added to these ones,
+    // so that those of a baseline can be computed once and shared.
+    explicit Fingerprints(const Fingerprints * base = nullptr): base(base) {}
+
+    // Computes fingerprints of the type and of all the types it refers to.
+    void add(const Descriptor * desc);
+    void add(const EnumDescriptor * enum_desc);
+
+    // Whether both types have fingerprints and they are equal.
+    // Does not modify the fingerprints, so it is safe to call from many threads.
+    bool equal(const Descriptor * desc1, const Descriptor * desc2) const;
+    bool equal(const EnumDescriptor * enum1, const EnumDescriptor * enum2) const;
+
+    void reserve(size_t type_count) { fingerprints.reserve(type_count); }
+
+private:
+    struct Fingerprint
+    {
+        uint64_t hash = 0;
+        // False if the type may appear changed even when compared to a copy of itself,
+        // for example due to a NaN default value, or if it refers to such a type.
+        bool valid = true;
+    };
+
+    // Adds fingerprints of message types that refer to each other in a cycle,
+    // or of a single type outside of any cycle.
+    void add_component(std::vector<const Descriptor*> & members);
+
+    bool equal(const void * type1, const void * type2) const;
+
+    // The fingerprint of the type, here or in the base, or null.
+    const Fingerprint * find(const void * type) const;
+
+    const Fingerprints * base;
+    std::unordered_map<const void*, Fingerprint> fingerprints;
+};
@@ -0,0 +1,254 @@
+#include "git.h"
+
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
+#include <ctime>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+using google::protobuf::io::ArrayInputStream;
+using google::protobuf::io::ZeroCopyInputStream;
+
+namespace {
+
+// Starts git in the directory with the arguments, connected through pipes.
+pid_t start_git(const string & dir, const vector<string> & args, FILE ** input, FILE ** output)
+{
+    // The parent's ends are not inherited by processes started in other threads meanwhile.
+    // The child's ends lose the flag when duplicated to its stdin and stdout.
+    int input_pipe[2];
+    int output_pipe[2];
+
+    if (pipe2(input_pipe, O_CLOEXEC) != 0)
+        throw std::runtime_error("Failed to run git.");
+
+    if (pipe2(output_pipe, O_CLOEXEC) != 0)
+    {
+        close(input_pipe[0]);
+        close(input_pipe[1]);
+        throw std::runtime_error("Failed to run git.");
+    }
+
+    vector<const char*> argv { "git", "-C", dir.c_str() };
+    for (auto & arg : args)
+        argv.push_back(arg.c_str());
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(input_pipe[0], STDIN_FILENO);
+        dup2(output_pipe[1], STDOUT_FILENO);
+        close(input_pipe[0]);
+        close(input_pipe[1]);
+        close(output_pipe[0]);
+        close(output_pipe[1]);
+        execvp("git", const_cast<char * const *>(argv.data()));
+        _exit(127);
+    }
+
+    close(input_pipe[0]);
+    close(output_pipe[1]);
+
+    if (pid < 0)
+    {
+        close(input_pipe[1]);
+        close(output_pipe[0]);
+        throw std::runtime_error("Failed to run git.");
+    }
+
+    *input = fdopen(input_pipe[1], "w");
+    *output = fdopen(output_pipe[0], "r");
+
+    return pid;
+}
+
+bool finish_git(pid_t pid)
+{
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+            return false;
+    }
+    return WIFEXITED(status) and WEXITSTATUS(status) == 0;
+}
+
+// Writes the text to git and flushes it, or returns false if it fails.
+// A git process that exits is found by the failing write, instead of a signal ending the program.
+// The signal is blocked in this thread only while writing, and taken if the write raised it,
+// so that the signal handling of the program is left as it is.
+bool write_git(FILE * input, const string & text)
+{
+    sigset_t sigpipe;
+    sigset_t old_mask;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+
+    sigset_t pending;
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE);
+
+    bool ok = fputs(text.c_str(), input) >= 0 and fflush(input) == 0;
+
+    if (!ok and errno == EPIPE and !was_pending)
+    {
+        timespec no_wait { 0, 0 };
+        while (sigtimedwait(&sigpipe, nullptr, &no_wait) < 0 and errno == EINTR)
+            ;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    return ok;
+}
+
+// Runs git to completion and returns its output, or throws if it fails.
+string run_git(const string & dir, const vector<string> & args)
+{
+    FILE * input;
+    FILE * output;
+    pid_t pid = start_git(dir, args, &input, &output);
+    fclose(input);
+
+    string result;
+    char buffer[4096];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), output)) > 0)
+        result.append(buffer, size);
+    fclose(output);
+
+    if (!finish_git(pid))
+        throw std::runtime_error("Failed to run git in " + dir);
+
+    return result;
+}
+
+string resolve_commit(const string & root_dir, const string & revision)
+{
+    string commit;
+    try
+    {
+        commit = run_git(root_dir, { "rev-parse", "--verify", "--quiet", revision + "^{commit}" });
+    }
+    catch (std::exception &)
+    {
+        throw std::runtime_error("Invalid git revision: " + revision);
+    }
+
+    while (!commit.empty() and commit.back() == '\n')
+        commit.pop_back();
+
+    return commit;
+}
+
+// A stream that owns the contents it reads.
+class BlobInputStream : public ZeroCopyInputStream
+{
+public:
+    BlobInputStream(string contents):
+        contents(std::move(contents)),
+        stream(this->contents.data(), this->contents.size())
+    {}
+
+    bool Next(const void ** data, int * size) override { return stream.Next(data, size); }
+    void BackUp(int count) override { stream.BackUp(count); }
+    bool Skip(int count) override { return stream.Skip(count); }
+    int64_t ByteCount() const override { return stream.ByteCount(); }
+
+private:
+    string contents;
+    ArrayInputStream stream;
+};
+
+}
+
+GitSourceTree::GitSourceTree(const string & root_dir, const string & revision, bool resolve):
+    root_dir(root_dir),
+    commit(resolve ? resolve_commit(root_dir, revision) : revision)
+{
+    process = start_git(root_dir, { "cat-file", "--batch" }, &requests, &responses);
+}
+
+GitSourceTree::~GitSourceTree()
+{
+    fclose(requests);
+    fclose(responses);
+    finish_git(process);
+}
+
+ZeroCopyInputStream * GitSourceTree::Open(const string & filename)
+{
+    if (filename.find('\n') != string::npos)
+    {
+        last_error = "Invalid file name.";
+        return nullptr;
+    }
+
+    // Paths starting with "./" are relative to the directory git runs in.
+    string object = commit + ":./" + filename;
+    if (!write_git(requests, object + "\n"))
+        throw std::runtime_error("Failed to write to git in " + root_dir);
+
+    // The response is "<hash> <type> <size>" and the contents,
+    // or "<object> missing", which is as long as the object name.
+    char * line = nullptr;
+    size_t capacity = 0;
+    ssize_t length = getline(&line, &capacity, responses);
+    string header = length > 0 ? string(line, length) : string();
+    free(line);
+    if (length <= 0)
+        throw std::runtime_error("Failed to read from git in " + root_dir);
+
+    char type[32];
+    unsigned long long size;
+    if (sscanf(header.c_str(), "%*s %31s %llu", type, &size) != 2)
+    {
+        last_error = "File not found.";
+        return nullptr;
+    }
+
+    string contents(size, '\0');
+    if (fread(&contents[0], 1, size, responses) != size or fgetc(responses) != '\n')
+        throw std::runtime_error("Failed to read from git in " + root_dir);
+
+    if (string(type) != "blob")
+    {
+        last_error = "Not a file.";
+        return nullptr;
+    }
+
+    return new BlobInputStream(std::move(contents));
+}
+
+vector<string> GitSourceTree::find_files(const string & root_dir, const string & revision)
+{
+    string commit = resolve_commit(root_dir, revision);
+
+    // Paths are listed relative to the directory git runs in, separated by null characters.
+    string output = run_git(root_dir, { "ls-tree", "-r", "-z", "--name-only", commit });
+
+    vector<string> files;
+    size_t start = 0;
+    size_t end;
+    while ((end = output.find('\0', start)) != string::npos)
+    {
+        string path = output.substr(start, end - start);
+        start = end + 1;
+        if (path.size() > 6 and path.compare(path.size() - 6, 6, ".proto") == 0)
+            files.push_back(path);
+    }
+
+    std::sort(files.begin(), files.end());
+
+    return files;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <google/protobuf/compiler/importer.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Reads files of a git revision straight from the object database, without a checkout.
+// Files are read on demand, as the importer asks for them,
+// through one 'git cat-file --batch' process. A process that exits makes Open throw,
+// without SIGPIPE reaching the program, whose signal handling is not changed.
+class GitSourceTree : public google::protobuf::compiler::SourceTree
+{
+public:
+    // Paths are relative to root_dir, which is a directory in a git work tree.
+    // The revision is resolved to a commit once, when constructed, unless it is already
+    // a commit resolved by another tree, which is not resolved again if 'resolve' is false.
+    GitSourceTree(const std::string & root_dir, const std::string & revision, bool resolve = true);
+    ~GitSourceTree() override;
+
+    google::protobuf::io::ZeroCopyInputStream * Open(const std::string & filename) override;
+    std::string GetLastErrorMessage() override { return last_error; }
+
+    // The commit the revision was resolved to.
+    const std::string & resolved_commit() const { return commit; }
+
+    // Relative paths of all .proto files under the root directory in the revision, in sorted order.
+    static std::vector<std::string> find_files(const std::string & root_dir, const std::string & revision);
+
+private:
+    std::string root_dir;
+    std::string commit;
+    std::string last_error;
+
+    pid_t process = -1;
+    FILE * requests = nullptr;
+    FILE * responses = nullptr;
+};
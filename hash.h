@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+// 64-bit FNV-1a, which is stable across platforms and runs.
+class Hash
+{
+public:
+    void add(std::string_view data)
+    {
+        for (unsigned char c : data)
+            add_byte(c);
+        // Separates consecutive strings.
+        add_byte(0xff);
+    }
+
+    void add(uint64_t number)
+    {
+        for (int i = 0; i < 8; ++i)
+            add_byte((number >> (i * 8)) & 0xff);
+    }
+
+    uint64_t value() const { return d_value; }
+
+    std::string hex() const
+    {
+        std::ostringstream text;
+        text << std::hex;
+        text.width(16);
+        text.fill('0');
+        text << d_value;
+        return text.str();
+    }
+
+private:
+    void add_byte(unsigned char c)
+    {
+        d_value ^= c;
+        d_value *= 0x100000001b3;
+    }
+
+    uint64_t d_value = 0xcbf29ce484222325;
+};
@@ -1,48 +1,766 @@
 #include "comparison.h"
+#include "batch.h"
+#include "tree.h"
+#include "matrix.h"
+#include "watch.h"
+#include "git.h"
+#include "server.h"
+#include "report.h"
+#include "result_file.h"
 
 #include <iostream>
+#include <fstream>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <future>
+#include <memory>
 
 using namespace std;
 
-int main(int argc, char * argv[])
+enum OutputFormat
 {
-    if (argc < 6)
+    Text_Output,
+    Json_Output,
+    // Only of single comparisons, in the format of result files.
+    Binary_Output
+};
+
+struct Settings
+{
+    Comparison::Options options;
+    OutputFormat format = Text_Output;
+    string cache_dir;
+    // Git revisions of the root directories, if not empty.
+    string revision1;
+    string revision2;
+    // Whether to write statistics to stderr after the result.
+    bool statistics = false;
+    // Types of items to find, parsed once all options are known, if not empty.
+    string items;
+};
+
+static
+void print_usage()
+{
+    cerr << "Expected arguments: root-dir1 file1 root-dir2 file2 type [options]" << endl;
+    cerr << "Use '.' for <type> to compare all messages and enums in given files." << endl;
+    cerr << "Or: --batch root-dir1 root-dir2 manifest [options]" << endl;
+    cerr << "Each line of <manifest> is: file1 file2 type" << endl;
+    cerr << "Or: --tree root-dir1 root-dir2 [options]" << endl;
+    cerr << "Or: --matrix root-dir file version... [options]" << endl;
+    cerr << "Each <version> is a directory, or a git revision of <root-dir>." << endl;
+    cerr << "Or: --serve socket root-dir1 [options]" << endl;
+    cerr << "Or: --query socket file1 root-dir2 file2 type" << endl;
+    cerr << "Or: --read result-file [type] [--format=text|json]" << endl;
+    cerr << "Or: --watch root-dir1 file1 root-dir2 file2 type [options]" << endl;
+    cerr << "Options:" << endl;
+    cerr << "  --binary" << endl;
+    cerr << "  --jobs N" << endl;
+    cerr << "  --max-references N" << endl;
+    cerr << "  --format=text|json|binary" << endl;
+    cerr << "  --cache-dir DIR" << endl;
+    cerr << "  --rev1 REVISION" << endl;
+    cerr << "  --rev2 REVISION" << endl;
+    cerr << "  --top-level-only" << endl;
+    cerr << "  --no-skip-identical" << endl;
+    cerr << "  --verdict" << endl;
+    cerr << "  --only=breaking|ITEM-TYPE,..." << endl;
+    cerr << "  --stats" << endl;
+    cerr << "  --check-fingerprints" << endl;
+}
+
+static
+bool parse_options(int argc, char * argv[], int first, Settings & settings)
+{
+    auto & options = settings.options;
+
+    for (int i = first; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--binary")
+        {
+            options.binary = true;
+        }
+        else if (arg == "--jobs" and i + 1 < argc)
+        {
+            options.jobs = atoi(argv[++i]);
+            if (options.jobs < 1)
+            {
+                cerr << "Invalid number of jobs: " << argv[i] << endl;
+                return false;
+            }
+        }
+        else if (arg == "--max-references" and i + 1 < argc)
+        {
+            // Only digits, as a sign or other text would make a meaningless limit.
+            const char * value = argv[++i];
+            char * end = nullptr;
+            errno = 0;
+            options.max_references = strtoull(value, &end, 10);
+            if (!isdigit(static_cast<unsigned char>(value[0])) or *end or errno == ERANGE)
+            {
+                cerr << "Invalid number of references: " << value << endl;
+                return false;
+            }
+        }
+        else if (arg == "--format=text")
+        {
+            settings.format = Text_Output;
+        }
+        else if (arg == "--format=json")
+        {
+            settings.format = Json_Output;
+        }
+        else if (arg == "--format=binary")
+        {
+            settings.format = Binary_Output;
+        }
+        else if (arg == "--top-level-only")
+        {
+            options.nested_types = false;
+        }
+        else if (arg == "--skip-identical")
+        {
+            options.skip_identical = true;
+        }
+        else if (arg == "--no-skip-identical")
+        {
+            options.skip_identical = false;
+        }
+        else if (arg.rfind("--only=", 0) == 0)
+        {
+            settings.items = arg.substr(7);
+        }
+        else if (arg == "--verdict")
+        {
+            options.verdict_only = true;
+        }
+        else if (arg == "--stats")
+        {
+            settings.statistics = true;
+            options.statistics = true;
+        }
+        else if (arg == "--check-fingerprints")
+        {
+            options.check_fingerprints = true;
+        }
+        else if (arg == "--cache-dir" and i + 1 < argc)
+        {
+            settings.cache_dir = argv[++i];
+        }
+        else if (arg == "--rev1" and i + 1 < argc)
+        {
+            settings.revision1 = argv[++i];
+        }
+        else if (arg == "--rev2" and i + 1 < argc)
+        {
+            settings.revision2 = argv[++i];
+        }
+        else
+        {
+            cerr << "Unknown option: " << arg << endl;
+            return false;
+        }
+    }
+
+    // Which items are breaking depends on --binary, wherever it is given.
+    if (!settings.items.empty())
+    {
+        try
+        {
+            options.items = parse_item_types(settings.items, options.binary);
+        }
+        catch (std::exception & e)
+        {
+            cerr << e.what() << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static
+unique_ptr<Source> open_source(const string & file_path, const string & root_dir,
+                               const string & revision, const string & cache_dir, bool lazy)
+{
+    if (revision.empty())
+        return make_unique<Source>(file_path, root_dir, cache_dir, lazy);
+    else
+        return make_unique<Source>(file_path, make_unique<GitSourceTree>(root_dir, revision));
+}
+
+static
+unique_ptr<Reporter> make_reporter(OutputFormat format)
+{
+    if (format == Json_Output)
+        return make_unique<JsonReporter>(cout);
+    else if (format == Binary_Output)
+        return make_unique<BinaryReporter>(cout);
+    else
+        return make_unique<TextReporter>(cout);
+}
+
+// Exit code when breaking changes are found in verdict mode, and nothing else failed.
+static const int Breaking_Exit_Code = 2;
+
+static
+void write_result(Comparison & comparison, const Settings & settings)
+{
+    if (settings.options.verdict_only)
+        write_verdict(cout, comparison, settings.format == Json_Output);
+    else
+        comparison.report(*make_reporter(settings.format));
+}
+
+static
+int exit_code(int result, bool breaking, const Settings & settings)
+{
+    if (result == 0 and breaking and settings.options.verdict_only)
+        return Breaking_Exit_Code;
+    return result;
+}
+
+// Statistics are written to stderr, so they do not mix with results.
+static
+void write_statistics(const Statistics & statistics, const Settings & settings)
+{
+    if (!settings.statistics)
+        return;
+
+    statistics.write(cerr, settings.format == Json_Output);
+    if (settings.format == Json_Output)
+        cerr << '\n';
+}
+
+// In JSON format, each result is a line with an object
+// containing the compared files and the result.
+static
+void write_result_header(const string & file1, const string & file2, const string & type,
+                         OutputFormat format)
+{
+    if (format == Json_Output)
+    {
+        cout << "{\"file1\":";
+        write_json_string(cout, file1);
+        cout << ",\"file2\":";
+        write_json_string(cout, file2);
+        cout << ",\"type\":";
+        write_json_string(cout, type);
+        cout << ",\"result\":";
+    }
+    else
+    {
+        cout << "# " << file1 << " -> " << file2 << " : " << type << '\n';
+    }
+}
+
+static
+void write_result_footer(OutputFormat format)
+{
+    if (format == Json_Output)
+        cout << "}\n";
+}
+
+static
+int run_batch(const string & root_dir1, const string & root_dir2, const string & manifest_path,
+              const Settings & settings)
+{
+    int result = 0;
+    bool breaking = false;
+    Statistics statistics;
+
+    try
+    {
+        ifstream manifest_file(manifest_path);
+        if (!manifest_file.is_open())
+        {
+            cerr << "Failed to open manifest: " << manifest_path << endl;
+            return 1;
+        }
+
+        auto entries = Batch::read_manifest(manifest_file);
+
+        Batch batch(root_dir1, root_dir2, settings.revision1, settings.revision2);
+        batch.preparse(entries, settings.options.jobs);
+
+        for (auto & entry : entries)
+        {
+            write_result_header(entry.file1, entry.file2, entry.type, settings.format);
+
+            Comparison comparison(settings.options);
+
+            try
+            {
+                batch.compare(entry, comparison);
+            }
+            catch (std::exception & e)
+            {
+                cerr << e.what() << endl;
+                result = 1;
+                if (settings.format == Json_Output)
+                    cout << "null";
+                write_result_footer(settings.format);
+                continue;
+            }
+
+            write_result(comparison, settings);
+            breaking |= comparison.breaking();
+            statistics += comparison.statistics();
+
+            write_result_footer(settings.format);
+        }
+
+        statistics.load_time = batch.load_time();
+        write_statistics(statistics, settings);
+    }
+    catch(std::exception & e)
     {
-        cerr << "Expected arguments: root-dir1 file1 root-dir2 file2 type [--binary]" << endl;
-        cerr << "Use '.' for <type> to compare all messages and enums in given files." << endl;
+        cerr << e.what() << endl;
         return 1;
     }
 
-    Comparison::Options options;
+    return exit_code(result, breaking, settings);
+}
 
-    if (argc > 6)
+// Added and removed files are written first, with null in place of the missing file in JSON format.
+static
+void write_file_change(const char * change, const string & file, bool added, OutputFormat format)
+{
+    if (format == Json_Output)
+    {
+        cout << "{\"file1\":";
+        if (added)
+            cout << "null";
+        else
+            write_json_string(cout, file);
+        cout << ",\"file2\":";
+        if (added)
+            write_json_string(cout, file);
+        else
+            cout << "null";
+        cout << "}\n";
+    }
+    else
     {
-        for (int i = 6; i < argc; ++i)
+        cout << "# " << change << ": " << file << '\n';
+    }
+}
+
+static
+int run_tree(const string & root_dir1, const string & root_dir2, const Settings & settings)
+{
+    int result = 0;
+    bool breaking = false;
+    Statistics statistics;
+
+    try
+    {
+        Tree tree(root_dir1, root_dir2, settings.revision1, settings.revision2);
+
+        // Removed files remove their types.
+        breaking = !tree.removed_files().empty() and
+                Comparison::is_breaking(Comparison::File_Message_Removed, settings.options.binary);
+
+        for (auto & file : tree.removed_files())
+            write_file_change("File removed", file, false, settings.format);
+        for (auto & file : tree.added_files())
+            write_file_change("File added", file, true, settings.format);
+
+        tree.compare(settings.options, settings.options.jobs,
+                     [&](const string & file, Comparison * comparison, const string & error)
         {
-            string arg = argv[i];
-            if (arg == "--binary")
+            write_result_header(file, file, ".", settings.format);
+
+            if (comparison)
             {
-                options.binary = true;
+                write_result(*comparison, settings);
+                breaking |= comparison->breaking();
+                statistics += comparison->statistics();
             }
             else
             {
-                cerr << "Unknown option: " << arg << endl;
-                return 1;
+                cerr << error << endl;
+                result = 1;
+                if (settings.format == Json_Output)
+                    cout << "null";
+            }
+
+            write_result_footer(settings.format);
+        });
+
+        statistics.load_time = tree.load_time();
+        write_statistics(statistics, settings);
+    }
+    catch(std::exception & e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return exit_code(result, breaking, settings);
+}
+
+static
+int run_matrix(const string & root_dir, const string & file_path, const vector<string> & versions,
+               const Settings & settings)
+{
+    int result = 0;
+
+    try
+    {
+        Matrix matrix(root_dir, file_path, settings.options);
+        matrix.compare(versions, settings.options.jobs);
+
+        for (size_t i = 0; i < versions.size(); ++i)
+        {
+            if (!matrix.errors()[i].empty())
+            {
+                cerr << versions[i] << ": " << matrix.errors()[i] << endl;
+                result = 1;
             }
         }
+
+        matrix.write(cout, settings.format == Json_Output);
+
+        if (result == 0 and matrix.breaking())
+            result = Breaking_Exit_Code;
+    }
+    catch(std::exception & e)
+    {
+        cerr << e.what() << endl;
+        return 1;
     }
 
-    Comparison comparison(options);
+    return result;
+}
 
+// Reports a result file written with the binary format, or the section of one type in it.
+static
+int run_read(const string & path, const string & type, const Settings & settings)
+{
     try
     {
-        Source source1(argv[2], argv[1]);
-        Source source2(argv[4], argv[3]);
+        ResultFile file(path);
+        auto reporter = make_reporter(settings.format);
+
+        if (type.empty())
+        {
+            file.report(*reporter);
+        }
+        else if (!file.report(type, *reporter))
+        {
+            cerr << "No changes of type in result file: " << type << endl;
+            return 1;
+        }
+    }
+    catch(std::exception & e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    if (settings.format == Json_Output)
+        cout << '\n';
+
+    return 0;
+}
+
+// Writes the result once, then again after each change of files under the second root directory.
+// In JSON format, each result is a line with an object containing the changed files and the result.
+static
+int run_watch(char * argv[], const Settings & settings)
+{
+    try
+    {
+        Watch watch(argv[2], argv[3], settings.revision1, argv[4], argv[5], argv[6], settings.options);
+        watch.start();
+
+        vector<string> changed;
+        bool first = true;
+
+        while (true)
+        {
+            if (settings.format == Json_Output)
+            {
+                cout << "{\"changed\":[";
+                for (size_t i = 0; i < changed.size(); ++i)
+                {
+                    if (i)
+                        cout << ',';
+                    write_json_string(cout, changed[i]);
+                }
+                cout << "],\"result\":";
+            }
+            else if (!first)
+            {
+                cout << "# Changed:";
+                for (auto & file : changed)
+                    cout << ' ' << file;
+                cout << '\n';
+            }
+            first = false;
+
+            try
+            {
+                write_result(watch.update(changed), settings);
+            }
+            catch (std::exception & e)
+            {
+                cerr << e.what() << endl;
+                if (settings.format == Json_Output)
+                    cout << "null";
+            }
+
+            write_result_footer(settings.format);
+            cout.flush();
+
+            changed = watch.wait();
+        }
+    }
+    catch(std::exception & e)
+    {
+        cerr << e.what() << endl;
+    }
+
+    return 1;
+}
+
+// Results of many comparisons are not written in the binary format.
+static
+bool check_format(const Settings & settings, const char * mode)
+{
+    if (settings.format == Binary_Output)
+    {
+        cerr << "The binary format is not supported in " << mode << " mode." << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char * argv[])
+{
+    // Output is written in large blocks, not synchronized with stdio.
+    ios::sync_with_stdio(false);
+
+    Settings settings;
+
+    if (argc > 1 and string(argv[1]) == "--batch")
+    {
+        if (argc < 5)
+        {
+            print_usage();
+            return 1;
+        }
+
+        if (!parse_options(argc, argv, 5, settings) or !check_format(settings, "batch"))
+            return 1;
+
+        if (!settings.cache_dir.empty())
+        {
+            cerr << "The cache is not supported in batch mode." << endl;
+            return 1;
+        }
+
+        return run_batch(argv[2], argv[3], argv[4], settings);
+    }
+
+    if (argc > 1 and string(argv[1]) == "--matrix")
+    {
+        // Versions are all arguments up to the first option.
+        int first_option = 4;
+        while (first_option < argc and string(argv[first_option]).rfind("--", 0) != 0)
+            ++first_option;
+
+        if (first_option == 4)
+        {
+            print_usage();
+            return 1;
+        }
+
+        if (!parse_options(argc, argv, first_option, settings) or !check_format(settings, "matrix"))
+            return 1;
+
+        if (!settings.cache_dir.empty() or !settings.revision1.empty() or !settings.revision2.empty() or
+                settings.statistics)
+        {
+            cerr << "The cache, revisions and statistics are not supported in matrix mode." << endl;
+            return 1;
+        }
+
+        return run_matrix(argv[2], argv[3], vector<string>(argv + 4, argv + first_option), settings);
+    }
+
+    if (argc > 1 and string(argv[1]) == "--serve")
+    {
+        if (argc < 4)
+        {
+            print_usage();
+            return 1;
+        }
+
+        if (!parse_options(argc, argv, 4, settings) or !check_format(settings, "server"))
+            return 1;
+
+        if (settings.statistics)
+        {
+            cerr << "Statistics are not supported in server mode." << endl;
+            return 1;
+        }
+
+        try
+        {
+            Server server(argv[3], settings.revision1, settings.options, settings.format == Json_Output);
+            server.run(argv[2]);
+        }
+        catch (std::exception & e)
+        {
+            cerr << e.what() << endl;
+        }
+
+        return 1;
+    }
+
+    if (argc > 1 and string(argv[1]) == "--query")
+    {
+        if (argc != 7)
+        {
+            print_usage();
+            return 1;
+        }
+
+        string response;
+        try
+        {
+            response = Server::send(argv[2], string(argv[3]) + " " + argv[4] + " " + argv[5] + " " + argv[6]);
+        }
+        catch (std::exception & e)
+        {
+            cerr << e.what() << endl;
+            return 1;
+        }
+
+        auto status_end = response.find('\n');
+        string status = response.substr(0, status_end);
+        string body = status_end == string::npos ? string() : response.substr(status_end + 1);
+
+        if (status != "OK")
+        {
+            cerr << body;
+            return 1;
+        }
+
+        cout << body;
+        return 0;
+    }
+
+    if (argc > 1 and string(argv[1]) == "--read")
+    {
+        if (argc < 3)
+        {
+            print_usage();
+            return 1;
+        }
+
+        // The type is optional, before the options.
+        int first_option = 3;
+        string type;
+        if (argc > 3 and string(argv[3]).rfind("--", 0) != 0)
+            type = argv[first_option++];
+
+        if (!parse_options(argc, argv, first_option, settings) or !check_format(settings, "read"))
+            return 1;
+
+        return run_read(argv[2], type, settings);
+    }
+
+    if (argc > 1 and string(argv[1]) == "--watch")
+    {
+        if (argc < 7)
+        {
+            print_usage();
+            return 1;
+        }
+
+        if (!parse_options(argc, argv, 7, settings) or !check_format(settings, "watch"))
+            return 1;
+
+        if (!settings.cache_dir.empty() or !settings.revision2.empty() or settings.statistics)
+        {
+            cerr << "The cache, --rev2 and statistics are not supported in watch mode." << endl;
+            return 1;
+        }
+
+        return run_watch(argv, settings);
+    }
+
+    if (argc > 1 and string(argv[1]) == "--tree")
+    {
+        if (argc < 4)
+        {
+            print_usage();
+            return 1;
+        }
+
+        if (!parse_options(argc, argv, 4, settings) or !check_format(settings, "tree"))
+            return 1;
+
+        if (!settings.cache_dir.empty())
+        {
+            cerr << "The cache is not supported in tree mode." << endl;
+            return 1;
+        }
+
+        return run_tree(argv[2], argv[3], settings);
+    }
+
+    if (argc < 6)
+    {
+        print_usage();
+        return 1;
+    }
+
+    if (!parse_options(argc, argv, 6, settings))
+        return 1;
+
+    if (!settings.cache_dir.empty() and !(settings.revision1.empty() and settings.revision2.empty()))
+    {
+        cerr << "The cache is not supported with git revisions." << endl;
+        return 1;
+    }
+
+    if (settings.format == Binary_Output and settings.options.verdict_only)
+    {
+        cerr << "The binary format is not supported with a verdict." << endl;
+        return 1;
+    }
+
+    // The sources must outlive the comparison, which refers to their names.
+    unique_ptr<Source> source1;
+    unique_ptr<Source> source2;
+
+    Comparison comparison(settings.options);
+    double load_time = 0;
+
+    try
+    {
+        // Comparing one type only needs the imports it refers to.
         string message_name = argv[5];
+        bool lazy = message_name != ".";
+
+        {
+            // The sources are independent, so they are loaded at the same time.
+            PhaseTimer timer(load_time);
+            auto loading = async(launch::async, open_source, argv[4], argv[3], settings.revision2,
+                                 settings.cache_dir, lazy);
+            source1 = open_source(argv[2], argv[1], settings.revision1, settings.cache_dir, lazy);
+            source2 = loading.get();
+        }
         if (message_name == ".")
-            comparison.compare(source1, source2);
+            comparison.compare(*source1, *source2);
         else
-            comparison.compare(source1, message_name, source2, message_name);
+            comparison.compare(*source1, message_name, *source2, message_name);
     }
     catch(std::exception & e)
     {
@@ -50,9 +768,16 @@ int main(int argc, char * argv[])
         return 1;
     }
 
-    comparison.root.trim();
-    comparison.root.print();
+    write_result(comparison, settings);
 
-    return 0;
-}
+    if (settings.format == Json_Output)
+        cout << '\n';
 
+    auto statistics = comparison.statistics();
+    statistics.load_time = load_time;
+    // Results are complete before statistics, in case both go to the same terminal.
+    cout.flush();
+    write_statistics(statistics, settings);
+
+    return exit_code(0, comparison.breaking(), settings);
+}
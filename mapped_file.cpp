@@ -0,0 +1,44 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+MappedFile::MappedFile(const string & path, const string & kind)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Failed to open " + kind + ": " + path);
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Failed to open " + kind + ": " + path);
+    }
+
+    size = info.st_size;
+
+    if (size > 0)
+    {
+        void * address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED)
+        {
+            ::close(fd);
+            throw std::runtime_error("Failed to map " + kind + ": " + path);
+        }
+        data = static_cast<const uint8_t*>(address);
+    }
+
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data)
+        munmap(const_cast<uint8_t*>(data), size);
+}
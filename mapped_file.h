@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A file mapped into memory read-only, for as long as the object exists.
+class MappedFile
+{
+public:
+    // Throws, naming the kind of file, if it cannot be opened or mapped.
+    MappedFile(const std::string & path, const std::string & kind);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    const uint8_t * data = nullptr;
+    size_t size = 0;
+};
@@ -0,0 +1,194 @@
+#include "matrix.h"
+#include "report.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+Matrix::Matrix(const string & root_dir, const string & file_path, const Comparison::Options & options):
+    root_dir(root_dir),
+    file_path(file_path),
+    options(options),
+    source(file_path, root_dir)
+{
+    baseline = make_unique<Comparison::Baseline>(source.file_descriptor(), options);
+}
+
+void Matrix::compare(const vector<string> & versions, int jobs)
+{
+    d_versions = versions;
+    d_errors.assign(versions.size(), string());
+    d_rows.clear();
+
+    // Names are copied, so that each version is released once compared.
+    vector<vector<pair<string, Comparison::TypeStatus>>> results(versions.size());
+
+    Comparison::Options version_options = options;
+    version_options.jobs = 1;
+
+    std::atomic<size_t> next_version { 0 };
+
+    auto work = [&]()
+    {
+        size_t i;
+        while ((i = next_version++) < versions.size())
+        {
+            try
+            {
+                const string & version = versions[i];
+                bool directory = filesystem::is_directory(version);
+
+                auto version_source = Source::at_revision(directory ? version : root_dir,
+                                                          directory ? string() : version);
+                auto * file = version_source.import(file_path);
+
+                Comparison comparison(version_options, baseline.get());
+                for (auto & result : comparison.compare_types(file, source.file_descriptor()))
+                    results[i].emplace_back(string(result.name), result.status);
+            }
+            catch (std::exception & e)
+            {
+                d_errors[i] = e.what();
+                results[i].clear();
+            }
+        }
+    };
+
+    vector<std::thread> threads;
+    for (size_t i = 0; i < std::min<size_t>(std::max(jobs, 1), versions.size()); ++i)
+        threads.emplace_back(work);
+    for (auto & thread : threads)
+        thread.join();
+
+    unordered_map<string, size_t> row_indexes;
+
+    for (size_t i = 0; i < versions.size(); ++i)
+    {
+        for (auto & [name, status] : results[i])
+        {
+            auto found = row_indexes.find(name);
+            if (found == row_indexes.end())
+            {
+                d_rows.push_back({ name, vector<optional<Comparison::TypeStatus>>(versions.size()) });
+                found = row_indexes.emplace(name, d_rows.size() - 1).first;
+            }
+            d_rows[found->second].results[i] = status;
+        }
+    }
+}
+
+bool Matrix::is_breaking(Comparison::TypeStatus status) const
+{
+    switch (status)
+    {
+    case Comparison::Type_Breaking:
+        return true;
+    case Comparison::Type_Removed:
+        return Comparison::is_breaking(Comparison::File_Message_Removed, options.binary) and
+                (options.items & Comparison::item_bit(Comparison::File_Message_Removed));
+    default:
+        return false;
+    }
+}
+
+bool Matrix::breaking() const
+{
+    for (auto & row : d_rows)
+    {
+        for (auto & result : row.results)
+        {
+            if (result and is_breaking(*result))
+                return true;
+        }
+    }
+    return false;
+}
+
+const char * Matrix::status_string(Comparison::TypeStatus status)
+{
+    switch (status)
+    {
+    case Comparison::Type_Compatible:
+        return "compatible";
+    case Comparison::Type_Breaking:
+        return "breaking";
+    case Comparison::Type_Added:
+        return "added";
+    case Comparison::Type_Removed:
+        return "removed";
+    }
+    return "";
+}
+
+void Matrix::write(ostream & out, bool json) const
+{
+    if (json)
+    {
+        out << "{\"versions\":[";
+        for (size_t i = 0; i < d_versions.size(); ++i)
+        {
+            if (i)
+                out << ',';
+            write_json_string(out, d_versions[i]);
+        }
+        out << "],\"types\":[";
+        for (size_t i = 0; i < d_rows.size(); ++i)
+        {
+            if (i)
+                out << ',';
+            out << "{\"type\":";
+            write_json_string(out, d_rows[i].type);
+            out << ",\"results\":[";
+            for (size_t j = 0; j < d_rows[i].results.size(); ++j)
+            {
+                if (j)
+                    out << ',';
+                auto & result = d_rows[i].results[j];
+                if (result)
+                    out << '"' << status_string(*result) << '"';
+                else
+                    out << "null";
+            }
+            out << "]}";
+        }
+        out << "]}\n";
+        return;
+    }
+
+    // Columns are aligned, with a header of version names.
+    const string type_header = "Type";
+    const string missing = "-";
+
+    size_t type_width = type_header.size();
+    for (auto & row : d_rows)
+        type_width = std::max(type_width, row.type.size());
+
+    vector<size_t> widths;
+    for (auto & version : d_versions)
+        widths.push_back(std::max(version.size(), string_view("compatible").size()));
+
+    // Without trailing spaces in the last column.
+    auto write_cell = [&](string_view text, size_t i)
+    {
+        out << "  " << text;
+        if (i + 1 < widths.size())
+            out << string(widths[i] - std::min(widths[i], text.size()), ' ');
+    };
+
+    out << type_header << string(type_width - type_header.size(), ' ');
+    for (size_t i = 0; i < d_versions.size(); ++i)
+        write_cell(d_versions[i], i);
+    out << '\n';
+
+    for (auto & row : d_rows)
+    {
+        out << row.type << string(type_width - row.type.size(), ' ');
+        for (size_t i = 0; i < row.results.size(); ++i)
+            write_cell(row.results[i] ? status_string(*row.results[i]) : missing, i);
+        out << '\n';
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "comparison.h"
+
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+
+// Compares one baseline file with many versions of it, and decides for each type
+// declared in them whether it is compatible or breaking in each version.
+// The baseline is loaded once, and its fingerprints and sorted fields are shared by all comparisons.
+class Matrix
+{
+public:
+    // The baseline is the newer side of each comparison.
+    Matrix(const string & root_dir, const string & file_path, const Comparison::Options & options);
+
+    // Each version is a directory, if one exists at that path, or otherwise a git revision
+    // of the baseline's root directory, containing the file at the same path.
+    // Versions are loaded and compared in 'jobs' threads, as the older side of each comparison.
+    void compare(const vector<string> & versions, int jobs);
+
+    struct Row
+    {
+        string type;
+        // By version, or empty if the type is in neither file, or the version failed to load.
+        vector<std::optional<Comparison::TypeStatus>> results;
+    };
+
+    const vector<string> & versions() const { return d_versions; }
+    // Error messages of loading each version, empty if it loaded.
+    const vector<string> & errors() const { return d_errors; }
+    // Types in order of comparison with the first version they are found in.
+    const vector<Row> & rows() const { return d_rows; }
+
+    // Whether any type is breaking in any version, including removed types if they are breaking.
+    bool breaking() const;
+
+    // One row per type after a header, or one JSON object on a line.
+    void write(std::ostream & out, bool json) const;
+
+    static const char * status_string(Comparison::TypeStatus status);
+
+private:
+    bool is_breaking(Comparison::TypeStatus status) const;
+
+    string root_dir;
+    string file_path;
+    Comparison::Options options;
+
+    Source source;
+    std::unique_ptr<Comparison::Baseline> baseline;
+
+    vector<string> d_versions;
+    vector<string> d_errors;
+    vector<Row> d_rows;
+};
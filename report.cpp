@@ -0,0 +1,263 @@
+#include "report.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+void TextReporter::indent()
+{
+    for (int i = 0; i < level; ++i)
+        out << "  ";
+}
+
+void TextReporter::begin_section(const Comparison::Section & section)
+{
+    indent();
+    section.write(out);
+    out << '\n';
+
+    ++level;
+
+    if (section.reference_count > section.references.size())
+    {
+        indent();
+        out << "Required by " << section.reference_count << " fields, first "
+            << section.references.size() << " shown" << '\n';
+    }
+
+    for (auto & reference : section.references)
+    {
+        indent();
+        reference.write(out);
+        out << '\n';
+    }
+}
+
+void TextReporter::item(const Comparison::Item & item)
+{
+    indent();
+    out << "* ";
+    item.write(out);
+    out << '\n';
+}
+
+void TextReporter::end_section(const Comparison::Section & /*section*/)
+{
+    --level;
+}
+
+const char * section_type_string(Comparison::SectionType type)
+{
+    switch(type)
+    {
+    case Comparison::Root_Section:
+        return "/";
+    case Comparison::Message_Comparison:
+        return "message_comparison";
+    case Comparison::Message_Field_Comparison:
+        return "message_field_comparison";
+    case Comparison::Enum_Comparison:
+        return "enum_comparison";
+    case Comparison::Enum_Value_Comparison:
+        return "enum_value_comparison";
+    default:
+        return "?";
+    }
+}
+
+const char * item_type_string(Comparison::ItemType type)
+{
+    switch (type)
+    {
+    case Comparison::Enum_Value_Name_Changed:
+        return "enum_value_name_changed";
+    case Comparison::Enum_Value_Id_Changed:
+        return "enum_value_id_changed";
+    case Comparison::Enum_Value_Added:
+        return "enum_value_added";
+    case Comparison::Enum_Value_Removed:
+        return "enum_value_removed";
+    case Comparison::Message_Field_Name_Changed:
+        return "message_field_name_changed";
+    case Comparison::Message_Field_Id_Changed:
+        return "message_field_id_changed";
+    case Comparison::Message_Field_Label_Changed:
+        return "message_field_label_changed";
+    case Comparison::Message_Field_Type_Changed:
+        return "message_field_type_changed";
+    case Comparison::Message_Field_Default_Value_Changed:
+        return "message_field_default_value_changed";
+    case Comparison::Message_Field_Added:
+        return "message_field_added";
+    case Comparison::Message_Field_Removed:
+        return "message_field_removed";
+    case Comparison::File_Message_Added:
+        return "file_message_added";
+    case Comparison::File_Message_Removed:
+        return "file_message_removed";
+    case Comparison::File_Enum_Added:
+        return "file_enum_added";
+    case Comparison::File_Enum_Removed:
+        return "file_enum_removed";
+    case Comparison::Name_Missing:
+        return "name_missing";
+    default:
+        return "?";
+    }
+}
+
+Comparison::ItemTypes parse_item_types(string_view list, bool binary)
+{
+    Comparison::ItemTypes items = 0;
+
+    while (true)
+    {
+        auto end = list.find(',');
+        auto name = list.substr(0, end);
+
+        if (name == "breaking")
+        {
+            items |= Comparison::breaking_items(binary);
+        }
+        else
+        {
+            int type = 0;
+            while (type <= Comparison::Name_Missing and name != item_type_string(Comparison::ItemType(type)))
+                ++type;
+            if (type > Comparison::Name_Missing)
+                throw std::runtime_error("Unknown item type: " + string(name));
+            items |= Comparison::item_bit(Comparison::ItemType(type));
+        }
+
+        if (end == string_view::npos)
+            break;
+        list.remove_prefix(end + 1);
+    }
+
+    return items;
+}
+
+void write_verdict(ostream & out, const Comparison & comparison, bool json)
+{
+    if (json)
+        out << "{\"breaking\":" << (comparison.breaking() ? "true" : "false") << '}';
+    else
+        out << (comparison.breaking() ? "Breaking" : "Compatible") << '\n';
+}
+
+void write_json_string(ostream & out, string_view text)
+{
+    static const char * hex = "0123456789abcdef";
+
+    out << '"';
+
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '"':
+            out << "\\\"";
+            break;
+        case '\\':
+            out << "\\\\";
+            break;
+        case '\n':
+            out << "\\n";
+            break;
+        case '\t':
+            out << "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+                out << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+            else
+                out << c;
+        }
+    }
+
+    out << '"';
+}
+
+void JsonReporter::begin_section(const Comparison::Section & section)
+{
+    if (!open.empty())
+    {
+        auto & parent = open.back();
+        if (parent == Section_Contents)
+        {
+            out << ',';
+        }
+        else
+        {
+            if (parent == Item_Contents)
+                out << ']';
+            out << ",\"sections\":[";
+            parent = Section_Contents;
+        }
+    }
+
+    out << "{\"type\":";
+    write_json_string(out, section_type_string(section.type));
+
+    if (section.type != Comparison::Root_Section)
+    {
+        out << ",\"a\":";
+        write_json_string(out, section.a);
+        out << ",\"b\":";
+        write_json_string(out, section.b);
+    }
+
+    if (!section.references.empty())
+    {
+        out << ",\"references\":[";
+        bool first = true;
+        for (auto & reference : section.references)
+        {
+            if (!first)
+                out << ',';
+            first = false;
+            out << "{\"a\":";
+            write_json_string(out, reference.a);
+            out << ",\"b\":";
+            write_json_string(out, reference.b);
+            out << '}';
+        }
+        out << ']';
+
+        if (section.reference_count > section.references.size())
+            out << ",\"reference_count\":" << section.reference_count;
+    }
+
+    open.push_back(No_Contents);
+}
+
+void JsonReporter::item(const Comparison::Item & item)
+{
+    auto & contents = open.back();
+    if (contents == Item_Contents)
+    {
+        out << ',';
+    }
+    else
+    {
+        out << ",\"items\":[";
+        contents = Item_Contents;
+    }
+
+    out << "{\"type\":";
+    write_json_string(out, item_type_string(item.type));
+    out << ",\"a\":";
+    write_json_string(out, item.a);
+    out << ",\"b\":";
+    write_json_string(out, item.b);
+    out << '}';
+}
+
+void JsonReporter::end_section(const Comparison::Section & /*section*/)
+{
+    if (open.back() != No_Contents)
+        out << ']';
+    out << '}';
+
+    open.pop_back();
+}
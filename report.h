@@ -0,0 +1,72 @@
+#pragma once
+
+#include "comparison.h"
+
+#include <ostream>
+
+// Receives the sections and items of a comparison result in order of output.
+// The section passed to begin_section() also provides its references.
+class Reporter
+{
+public:
+    virtual ~Reporter() {}
+
+    virtual void begin_section(const Comparison::Section & section) = 0;
+    virtual void item(const Comparison::Item & item) = 0;
+    virtual void end_section(const Comparison::Section & section) = 0;
+};
+
+// Writes the indented text format, without flushing the stream.
+class TextReporter : public Reporter
+{
+public:
+    TextReporter(std::ostream & out, int level = 0): out(out), level(level) {}
+
+    void begin_section(const Comparison::Section & section) override;
+    void item(const Comparison::Item & item) override;
+    void end_section(const Comparison::Section & section) override;
+
+private:
+    void indent();
+
+    std::ostream & out;
+    int level;
+};
+
+// Writes one JSON object per section, in the layout of tests/*/diff.json:
+// "type", "a", "b", and if not empty, "references", "items" and "sections".
+// The number of references is included as "reference_count" if only some are listed.
+class JsonReporter : public Reporter
+{
+public:
+    JsonReporter(std::ostream & out): out(out) {}
+
+    void begin_section(const Comparison::Section & section) override;
+    void item(const Comparison::Item & item) override;
+    void end_section(const Comparison::Section & section) override;
+
+private:
+    enum Contents
+    {
+        No_Contents,
+        Item_Contents,
+        Section_Contents
+    };
+
+    std::ostream & out;
+    // For each section being reported, which array is open.
+    vector<Contents> open;
+};
+
+const char * section_type_string(Comparison::SectionType type);
+const char * item_type_string(Comparison::ItemType type);
+
+// Parses a comma-separated list of item types, as named by item_type_string(), where "breaking"
+// stands for the types of breaking items. Throws if a name is not known.
+Comparison::ItemTypes parse_item_types(string_view list, bool binary);
+
+void write_json_string(std::ostream & out, string_view text);
+
+// Writes whether the comparison found breaking changes, as a line of text
+// or as a JSON object {"breaking": true|false} without a line break.
+void write_verdict(std::ostream & out, const Comparison & comparison, bool json);
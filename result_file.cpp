@@ -0,0 +1,269 @@
+#include "result_file.h"
+#include "mapped_file.h"
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+using namespace std;
+
+using google::protobuf::io::CodedInputStream;
+
+static const string_view magic = "PSCR";
+static const uint64_t format_version = 1;
+
+static
+void append_varint(string & out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+void BinaryReporter::write_string(string_view text)
+{
+    auto result = string_indexes.try_emplace(text, strings.size());
+    if (result.second)
+        strings.push_back(text);
+    append_varint(body, result.first->second);
+}
+
+void BinaryReporter::begin_section(const Comparison::Section & section)
+{
+    if (level == 1)
+        index.emplace_back(section.a, body.size());
+    ++level;
+
+    append_varint(body, section.type);
+    write_string(section.a);
+    write_string(section.b);
+
+    append_varint(body, section.reference_count);
+    append_varint(body, section.references.size());
+    for (auto & reference : section.references)
+    {
+        write_string(reference.a);
+        write_string(reference.b);
+    }
+
+    // The section is complete when reported, so its items and subsections are known.
+    append_varint(body, section.items.size());
+    append_varint(body, section.subsections.size());
+}
+
+void BinaryReporter::item(const Comparison::Item & item)
+{
+    append_varint(body, item.type);
+    write_string(item.a);
+    write_string(item.b);
+}
+
+void BinaryReporter::end_section(const Comparison::Section & /*section*/)
+{
+    --level;
+    if (level > 0)
+        return;
+
+    // All strings are known once the root section ends.
+    string header(magic);
+    append_varint(header, format_version);
+
+    append_varint(header, strings.size());
+    for (auto & text : strings)
+    {
+        append_varint(header, text.size());
+        header.append(text);
+    }
+
+    std::sort(index.begin(), index.end());
+    append_varint(header, index.size());
+    for (auto & [name, offset] : index)
+    {
+        append_varint(header, string_indexes.at(name));
+        append_varint(header, offset);
+    }
+
+    append_varint(header, body.size());
+
+    out.write(header.data(), header.size());
+    out.write(body.data(), body.size());
+}
+
+namespace {
+
+// Reads the numbers and text of a result file, and throws if they are invalid.
+class Input
+{
+public:
+    Input(const uint8_t * data, size_t size, const string & path):
+        data(data), input(data, int(std::min<size_t>(size, INT_MAX))), path(path)
+    {
+        if (size > INT_MAX)
+            fail();
+    }
+
+    uint64_t varint()
+    {
+        uint64_t value;
+        if (!input.ReadVarint64(&value))
+            fail();
+        return value;
+    }
+
+    string_view bytes(uint64_t size)
+    {
+        int position = input.CurrentPosition();
+        if (size > INT_MAX or !input.Skip(int(size)))
+            fail();
+        return string_view(reinterpret_cast<const char*>(data) + position, size);
+    }
+
+    string_view string(const vector<string_view> & strings)
+    {
+        uint64_t index = varint();
+        if (index >= strings.size())
+            fail();
+        return strings[index];
+    }
+
+    [[noreturn]] void fail() const
+    {
+        throw std::runtime_error("Invalid result file: " + path);
+    }
+
+private:
+    const uint8_t * data;
+    CodedInputStream input;
+    const std::string & path;
+};
+
+}
+
+ResultFile::ResultFile(const string & path):
+    path(path),
+    file(make_unique<MappedFile>(path, "result file"))
+{
+    Input input(file->data, file->size, path);
+
+    if (file->size < magic.size() or input.bytes(magic.size()) != magic or input.varint() != format_version)
+        input.fail();
+
+    uint64_t string_count = input.varint();
+    strings.reserve(std::min<uint64_t>(string_count, file->size));
+    for (uint64_t i = 0; i < string_count; ++i)
+        strings.push_back(input.bytes(input.varint()));
+
+    uint64_t index_count = input.varint();
+    index.reserve(std::min<uint64_t>(index_count, file->size));
+    for (uint64_t i = 0; i < index_count; ++i)
+    {
+        auto name = input.string(strings);
+        index.emplace_back(name, input.varint());
+    }
+
+    body_size = input.varint();
+    body = reinterpret_cast<const uint8_t*>(input.bytes(body_size).data());
+}
+
+ResultFile::~ResultFile() {}
+
+vector<string_view> ResultFile::types() const
+{
+    vector<string_view> names;
+    for (auto & entry : index)
+        names.push_back(entry.first);
+    return names;
+}
+
+void ResultFile::report(Reporter & reporter) const
+{
+    report_section(0, reporter);
+}
+
+bool ResultFile::report(string_view type, Reporter & reporter) const
+{
+    auto found = std::lower_bound(index.begin(), index.end(), type,
+                                  [](auto & entry, string_view name) { return entry.first < name; });
+    if (found == index.end() or found->first != type)
+        return false;
+
+    report_section(found->second, reporter);
+    return true;
+}
+
+void ResultFile::report_section(uint64_t offset, Reporter & reporter) const
+{
+    Input input(body + std::min<uint64_t>(offset, body_size), body_size - std::min<uint64_t>(offset, body_size), path);
+    if (offset >= body_size)
+        input.fail();
+
+    // Sections being reported, with references and their number, which reporters
+    // get with the section, and the number of their subsections still to read.
+    // Sections are read with an explicit stack, as they may be nested deeply.
+    struct Frame
+    {
+        Comparison::Section * section;
+        uint64_t subsections;
+    };
+
+    Arena arena;
+    vector<Frame> frames;
+
+    auto read_section = [&]()
+    {
+        uint64_t type = input.varint();
+        if (type > Comparison::Enum_Value_Comparison)
+            input.fail();
+        auto a = input.string(strings);
+        auto b = input.string(strings);
+        auto * section = arena.make<Comparison::Section>(&arena, Comparison::SectionType(type), a, b);
+
+        section->reference_count = input.varint();
+        uint64_t listed = input.varint();
+        if (listed > section->reference_count)
+            input.fail();
+        for (uint64_t i = 0; i < listed; ++i)
+        {
+            auto a = input.string(strings);
+            auto b = input.string(strings);
+            section->references.push_back(arena.make<Comparison::Reference>(a, b));
+        }
+
+        reporter.begin_section(*section);
+
+        uint64_t item_count = input.varint();
+        uint64_t subsection_count = input.varint();
+        for (uint64_t i = 0; i < item_count; ++i)
+        {
+            uint64_t type = input.varint();
+            if (type > Comparison::Name_Missing)
+                input.fail();
+            auto a = input.string(strings);
+            auto b = input.string(strings);
+            reporter.item(Comparison::Item(Comparison::ItemType(type), a, b));
+        }
+
+        frames.push_back({ section, subsection_count });
+    };
+
+    read_section();
+
+    while (!frames.empty())
+    {
+        auto & frame = frames.back();
+        if (frame.subsections == 0)
+        {
+            reporter.end_section(*frame.section);
+            frames.pop_back();
+            continue;
+        }
+
+        --frame.subsections;
+        read_section();
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "report.h"
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+class MappedFile;
+
+// Compact binary format of comparison results, for storing many of them cheaply.
+// All numbers are varints, and all text is stored once in a table of strings.
+//
+// A file is the magic "PSCR" and the format version, then:
+// - The number of strings, then the size and bytes of each one, in order of first use.
+// - The number of sections of compared types, those directly in the root section,
+//   then for each one, in order of its name in the first file: the name's string and its offset in the body.
+// - The size of the body, then the body, which is the root section. Each section is its type, a and b,
+//   its number of references and of those listed, a and b of each listed one, its numbers of items
+//   and of subsections, type, a and b of each item, then each subsection.
+// Types of sections and items are those of Comparison::SectionType and Comparison::ItemType.
+
+// Writes a result in the binary format once the root section ends.
+// Counts of items and subsections are taken from each section when it begins, so sections
+// must be complete, as those of a comparison are, and not streamed item by item as
+// ResultFile::report does, whose results cannot be written with this reporter.
+class BinaryReporter : public Reporter
+{
+public:
+    explicit BinaryReporter(std::ostream & out): out(out) {}
+
+    void begin_section(const Comparison::Section & section) override;
+    void item(const Comparison::Item & item) override;
+    void end_section(const Comparison::Section & section) override;
+
+private:
+    void write_string(string_view text);
+
+    std::ostream & out;
+    int level = 0;
+
+    // Strings are valid until the result is written, as they belong to the comparison.
+    vector<string_view> strings;
+    std::unordered_map<string_view, uint64_t> string_indexes;
+    // Names in the first file of compared types, and offsets of their sections.
+    vector<std::pair<string_view, uint64_t>> index;
+    string body;
+};
+
+// Reads a result in the binary format, mapped into memory, and reports it
+// to any reporter as it was reported when written.
+class ResultFile
+{
+public:
+    // Throws if the file cannot be read, or is not a result.
+    explicit ResultFile(const string & path);
+    ~ResultFile();
+
+    // Names in the first file of the compared types, in sorted order.
+    vector<string_view> types() const;
+
+    void report(Reporter & reporter) const;
+    // Reports only the section of the type, found by its name in the first file.
+    // Returns false if there is none, as the type has no changes.
+    bool report(string_view type, Reporter & reporter) const;
+
+private:
+    // Reports the section at the offset in the body, and its subsections.
+    void report_section(uint64_t offset, Reporter & reporter) const;
+
+    string path;
+    std::unique_ptr<MappedFile> file;
+
+    vector<string_view> strings;
+    // Sorted by name.
+    vector<std::pair<string_view, uint64_t>> index;
+    const uint8_t * body = nullptr;
+    size_t body_size = 0;
+};
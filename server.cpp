@@ -0,0 +1,243 @@
+#include "server.h"
+#include "report.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// Requests are short, so a longer line is rejected.
+constexpr size_t max_request_size = 64 * 1024;
+
+sockaddr_un socket_address(const string & path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path too long: " + path);
+
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// Whether the file is the dependency or imports it, directly or not.
+bool depends_on(const FileDescriptor * file, const FileDescriptor * dependency)
+{
+    vector<const FileDescriptor*> pending { file };
+    std::unordered_set<const FileDescriptor*> visited { file };
+
+    while (!pending.empty())
+    {
+        auto * current = pending.back();
+        pending.pop_back();
+        if (current == dependency)
+            return true;
+
+        for (int i = 0; i < current->dependency_count(); ++i)
+        {
+            if (visited.insert(current->dependency(i)).second)
+                pending.push_back(current->dependency(i));
+        }
+    }
+
+    return false;
+}
+
+bool write_all(int fd, const string & data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t count = write(fd, data.data() + written, data.size() - written);
+        if (count < 0 and errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        written += count;
+    }
+    return true;
+}
+
+// Reads until the end of the stream, or the end of the first line if 'line' is set.
+bool read_all(int fd, string & data, bool line)
+{
+    char buffer[4096];
+    while (true)
+    {
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count < 0 and errno == EINTR)
+            continue;
+        if (count < 0)
+            return false;
+        if (count == 0)
+            return true;
+
+        data.append(buffer, count);
+
+        if (line)
+        {
+            auto end = data.find('\n');
+            if (end != string::npos)
+            {
+                data.resize(end);
+                return true;
+            }
+            if (data.size() > max_request_size)
+                return false;
+        }
+    }
+}
+
+}
+
+Server::Server(const string & root_path, const string & revision,
+               const Comparison::Options & options, bool json_output):
+    baseline(Source::at_revision(root_path, revision)),
+    options(options),
+    json_output(json_output)
+{}
+
+string Server::respond(const string & request)
+{
+    ostringstream response;
+
+    try
+    {
+        istringstream fields(request);
+        string file1, root_dir2, file2, type, extra;
+        if (!(fields >> file1 >> root_dir2 >> file2 >> type) or (fields >> extra))
+            throw std::runtime_error("Expected: file1 root-dir2 file2 type");
+
+        auto * desc1 = baseline.import(file1);
+
+        // The baseline pool also holds files of earlier requests, so the type must be one of file1.
+        if (type != ".")
+        {
+            auto * message = baseline.pool()->FindMessageTypeByName(type);
+            auto * enum_type = baseline.pool()->FindEnumTypeByName(type);
+            auto * type_file = message ? message->file() : enum_type ? enum_type->file() : nullptr;
+            if (type_file and !depends_on(desc1, type_file))
+                throw std::runtime_error("Type not in " + file1 + " or its imports: " + type);
+        }
+
+        // The candidate must outlive the comparison, which refers to its names.
+        Source candidate(file2, root_dir2);
+
+        Comparison comparison(options);
+
+        if (type == ".")
+            comparison.compare(desc1, candidate.file_descriptor());
+        else
+            comparison.compare(baseline, type, candidate, type);
+
+        response << "OK\n";
+
+        if (options.verdict_only)
+        {
+            write_verdict(response, comparison, json_output);
+            if (json_output)
+                response << '\n';
+        }
+        else if (json_output)
+        {
+            JsonReporter reporter(response);
+            comparison.report(reporter);
+            response << '\n';
+        }
+        else
+        {
+            TextReporter reporter(response);
+            comparison.report(reporter);
+        }
+    }
+    catch (std::exception & e)
+    {
+        response.str(string());
+        response << "ERROR\n" << e.what() << '\n';
+    }
+
+    return response.str();
+}
+
+void Server::run(const string & socket_path)
+{
+    // Clients may leave before reading the response.
+    signal(SIGPIPE, SIG_IGN);
+
+    auto address = socket_address(socket_path);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0)
+        throw std::runtime_error("Failed to create socket.");
+
+    // Replace a socket left by a previous server.
+    unlink(socket_path.c_str());
+
+    if (::bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 or
+            listen(server, SOMAXCONN) != 0)
+    {
+        close(server);
+        throw std::runtime_error("Failed to listen on socket: " + socket_path);
+    }
+
+    while (true)
+    {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0)
+        {
+            if (errno == EINTR or errno == ECONNABORTED)
+                continue;
+            close(server);
+            throw std::runtime_error("Failed to accept connection on socket: " + socket_path);
+        }
+
+        // Do not wait forever for a client that sends no complete request, or reads no response.
+        timeval timeout { 5, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        string request;
+        if (read_all(client, request, true))
+            write_all(client, respond(request));
+        else
+            write_all(client, "ERROR\nInvalid request.\n");
+
+        close(client);
+    }
+}
+
+string Server::send(const string & socket_path, const string & request)
+{
+    auto address = socket_address(socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw std::runtime_error("Failed to create socket.");
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Failed to connect to socket: " + socket_path);
+    }
+
+    string response;
+    bool ok = write_all(fd, request + "\n") and read_all(fd, response, false);
+    close(fd);
+
+    if (!ok)
+        throw std::runtime_error("Failed to communicate through socket: " + socket_path);
+
+    return response;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "comparison.h"
+
+#include <string>
+
+// Answers comparison requests against a baseline kept in memory,
+// so that only the candidate side is parsed for each request.
+//
+// A request is one line: "file1 root-dir2 file2 type", where file1 is imported
+// from the baseline, and file2 from root-dir2. The response starts with a line
+// "OK" followed by the result, or "ERROR" followed by the error message.
+class Server
+{
+public:
+    // The baseline is read from the root path, as of the git revision if not empty.
+    Server(const string & root_path, const string & revision,
+           const Comparison::Options & options, bool json_output);
+
+    string respond(const string & request);
+
+    // Serves requests on a Unix socket at the path, one connection per request, until failure.
+    void run(const string & socket_path);
+
+    // Sends the request to a server at the socket path and returns the response.
+    static string send(const string & socket_path, const string & request);
+
+private:
+    Source baseline;
+    Comparison::Options options;
+    bool json_output;
+};
@@ -0,0 +1,315 @@
+#include "source.h"
+#include "cache.h"
+#include "git.h"
+#include "mapped_file.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <sys/stat.h>
+
+using namespace std;
+
+using google::protobuf::DescriptorDatabase;
+using google::protobuf::FileDescriptorProto;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::internal::WireFormatLite;
+
+// Files parsed in advance, handed to the pool once each,
+// in front of the database parsing files on demand.
+struct Source::ParsedFiles : public DescriptorDatabase
+{
+    explicit ParsedFiles(DescriptorDatabase * fallback): fallback(fallback) {}
+
+    bool FindFileByName(const string & filename, FileDescriptorProto * output) override
+    {
+        auto file = files.find(filename);
+        if (file == files.end())
+            return fallback->FindFileByName(filename, output);
+
+        output->Swap(&file->second);
+        files.erase(file);
+        return true;
+    }
+
+    // Only imported files are built, so symbols are not looked up in parsed files.
+    bool FindFileContainingSymbol(const string & symbol_name, FileDescriptorProto * output) override
+    {
+        return fallback->FindFileContainingSymbol(symbol_name, output);
+    }
+
+    bool FindFileContainingExtension(const string & containing_type, int field_number,
+                                     FileDescriptorProto * output) override
+    {
+        return fallback->FindFileContainingExtension(containing_type, field_number, output);
+    }
+
+    DescriptorDatabase * fallback;
+    unordered_map<string, FileDescriptorProto> files;
+};
+
+google::protobuf::io::ZeroCopyInputStream * MemorySourceTree::Open(const string & filename)
+{
+    auto file = files.find(filename);
+    if (file == files.end())
+        return nullptr;
+
+    return new google::protobuf::io::ArrayInputStream(file->second.data(), file->second.size());
+}
+
+static
+bool is_regular_file(const string & path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 and S_ISREG(info.st_mode);
+}
+
+Source::Source() {}
+
+Source::Source(const string & root_path)
+{
+    open(root_path);
+}
+
+Source::Source(const string & file_path, const string & root_path, const string & cache_dir, bool lazy):
+    lazy(lazy)
+{
+    if (cache_dir.empty() or is_regular_file(root_path))
+    {
+        open(root_path);
+        d_file_descriptor = import(file_path);
+        return;
+    }
+
+    SchemaCache cache(cache_dir);
+
+    string cached_path = cache.find(root_path, file_path);
+    if (!cached_path.empty())
+    {
+        try
+        {
+            load_descriptor_set(cached_path);
+            d_file_descriptor = import(file_path);
+            d_from_cache = true;
+            return;
+        }
+        catch (std::exception &)
+        {
+            // Parse the file as if it was not cached.
+            close_descriptor_set();
+        }
+    }
+
+    open_directory(root_path);
+    d_file_descriptor = import(file_path);
+    cache.store(root_path, d_file_descriptor);
+}
+
+Source::Source(unique_ptr<SourceTree> source_tree)
+{
+    open_source_tree(std::move(source_tree));
+}
+
+Source::Source(const string & file_path, unique_ptr<SourceTree> source_tree):
+    Source(std::move(source_tree))
+{
+    d_file_descriptor = import(file_path);
+}
+
+Source::Source(map<string, string> files):
+    Source(make_unique<MemorySourceTree>(std::move(files)))
+{}
+
+Source::Source(const string & file_path, map<string, string> files):
+    Source(file_path, make_unique<MemorySourceTree>(std::move(files)))
+{}
+
+Source Source::at_revision(const string & root_path, const string & revision)
+{
+    if (revision.empty())
+        return Source(root_path);
+
+    auto tree = make_unique<GitSourceTree>(root_path, revision);
+    string commit = tree->resolved_commit();
+
+    Source source(std::move(tree));
+    source.make_source_tree = [root_path, commit]
+    {
+        return make_unique<GitSourceTree>(root_path, commit, false);
+    };
+    return source;
+}
+
+Source::Source(Source && other) = default;
+
+Source::~Source() {}
+
+void Source::open(const string & root_path)
+{
+    if (is_regular_file(root_path))
+        load_descriptor_set(root_path);
+    else
+        open_directory(root_path);
+}
+
+void Source::open_directory(const string & root_dir)
+{
+    make_source_tree = [root_dir]() -> unique_ptr<SourceTree>
+    {
+        auto tree = make_unique<DiskSourceTree>();
+        tree->MapPath("", root_dir);
+        return tree;
+    };
+    open_source_tree(make_source_tree());
+}
+
+void Source::open_source_tree(unique_ptr<SourceTree> tree)
+{
+    source_tree = std::move(tree);
+
+    // The same as an Importer, apart from the files parsed in advance.
+    error_collector = make_unique<ErrorCollector>();
+    source_database = make_unique<SourceTreeDescriptorDatabase>(source_tree.get());
+    source_database->RecordErrorsTo(error_collector.get());
+    parsed_files = make_unique<ParsedFiles>(source_database.get());
+    descriptor_pool = make_unique<DescriptorPool>(parsed_files.get(),
+                                                  source_database->GetValidationErrorCollector());
+    descriptor_pool->EnforceWeakDependencies(true);
+
+    d_pool = descriptor_pool.get();
+}
+
+void Source::preparse(const vector<string> & file_paths, int jobs)
+{
+    if (!make_source_tree or file_paths.empty())
+        return;
+
+    vector<FileDescriptorProto> files(file_paths.size());
+    vector<char> parsed(file_paths.size(), false);
+    atomic<size_t> next_file { 0 };
+
+    // Each thread reads through its own source tree, as they are not thread-safe,
+    // and parses without reporting errors, which are reported when imported.
+    // The calling thread reads through the source's tree, which is not used meanwhile,
+    // so that only the other threads start reading sources, such as git processes, of their own.
+    auto parse = [&](SourceTree * tree)
+    {
+        SourceTreeDescriptorDatabase parser(tree);
+
+        size_t i;
+        while ((i = next_file++) < file_paths.size())
+            parsed[i] = parser.FindFileByName(file_paths[i], &files[i]);
+    };
+
+    auto work = [&]()
+    {
+        try
+        {
+            parse(make_source_tree().get());
+        }
+        catch (std::exception &)
+        {
+            // The remaining files are parsed when imported.
+        }
+    };
+
+    size_t thread_count = std::min<size_t>(std::max(jobs, 1), file_paths.size());
+
+    vector<thread> threads;
+    for (size_t i = 1; i < thread_count; ++i)
+        threads.emplace_back(work);
+    try
+    {
+        parse(source_tree.get());
+    }
+    catch (std::exception &)
+    {
+        // The remaining files are parsed by other threads, or when imported.
+    }
+    for (auto & thread : threads)
+        thread.join();
+
+    for (size_t i = 0; i < file_paths.size(); ++i)
+    {
+        if (parsed[i])
+            parsed_files->files[file_paths[i]].Swap(&files[i]);
+    }
+}
+
+void Source::add_parsed(const string & file_path, FileDescriptorProto file)
+{
+    if (parsed_files)
+        parsed_files->files[file_path].Swap(&file);
+}
+
+void Source::load_descriptor_set(const string & path)
+{
+    mapped_file = make_unique<MappedFile>(path, "descriptor set");
+    database = make_unique<EncodedDescriptorDatabase>();
+
+    // The files of a FileDescriptorSet are its field 1.
+    // They are added to the database without copying or parsing.
+
+    const uint32_t file_tag =
+            WireFormatLite::MakeTag(1, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+
+    CodedInputStream input(mapped_file->data, mapped_file->size);
+
+    while (uint32_t tag = input.ReadTag())
+    {
+        if (tag != file_tag)
+        {
+            if (!WireFormatLite::SkipField(&input, tag))
+                throw std::runtime_error("Invalid descriptor set: " + path);
+            continue;
+        }
+
+        uint32_t length;
+        if (!input.ReadVarint32(&length))
+            throw std::runtime_error("Invalid descriptor set: " + path);
+
+        int offset = input.CurrentPosition();
+        if (length > mapped_file->size - offset or !input.Skip(length))
+            throw std::runtime_error("Invalid descriptor set: " + path);
+
+        if (!database->Add(mapped_file->data + offset, length))
+            throw std::runtime_error("Invalid file in descriptor set: " + path);
+    }
+
+    if (!input.ConsumedEntireMessage())
+        throw std::runtime_error("Invalid descriptor set: " + path);
+
+    pool_error_collector = make_unique<PoolErrorCollector>();
+    descriptor_pool = make_unique<DescriptorPool>(database.get(), pool_error_collector.get());
+    // Descriptor sets are valid, as written by protoc or by the cache from built files.
+    if (lazy)
+        descriptor_pool->InternalSetLazilyBuildDependencies();
+
+    d_pool = descriptor_pool.get();
+}
+
+void Source::close_descriptor_set()
+{
+    descriptor_pool.reset();
+    pool_error_collector.reset();
+    database.reset();
+    mapped_file.reset();
+    d_pool = nullptr;
+}
+
+const google::protobuf::FileDescriptor * Source::import(const string & file_path)
+{
+    auto * file = d_pool->FindFileByName(file_path);
+
+    if (!file)
+    {
+        throw std::runtime_error("Failed to load source: " + file_path);
+    }
+
+    return file;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <google/protobuf/compiler/importer.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/descriptor_database.h>
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::shared_ptr;
+using std::unique_ptr;
+
+class MappedFile;
+
+class ErrorCollector : public google::protobuf::compiler::MultiFileErrorCollector
+{
+public:
+    ErrorCollector() {}
+
+    void AddError(const std::string & filename, int line, int column, const std::string & message) override
+    {
+        using namespace std;
+        cerr << "Error: " << filename << "@" << line << "," << column << ": " << message << endl;
+    }
+
+    void AddWarning(const std::string & filename, int line, int column, const std::string & message) override
+    {
+        using namespace std;
+        cerr << "Warning: " << filename << "@" << line << "," << column << ": " << message << endl;
+    }
+};
+
+// Reports errors in building descriptors from a descriptor set.
+class PoolErrorCollector : public google::protobuf::DescriptorPool::ErrorCollector
+{
+public:
+    PoolErrorCollector() {}
+
+    void AddError(const std::string & filename, const std::string & element_name,
+                  const google::protobuf::Message * /*descriptor*/, ErrorLocation /*location*/,
+                  const std::string & message) override
+    {
+        using namespace std;
+        cerr << "Error: " << filename << ": " << element_name << ": " << message << endl;
+    }
+
+    void AddWarning(const std::string & filename, const std::string & element_name,
+                    const google::protobuf::Message * /*descriptor*/, ErrorLocation /*location*/,
+                    const std::string & message) override
+    {
+        using namespace std;
+        cerr << "Warning: " << filename << ": " << element_name << ": " << message << endl;
+    }
+};
+
+// Serves files from memory, keyed by path.
+// Streams read the stored contents directly, without copying.
+class MemorySourceTree : public google::protobuf::compiler::SourceTree
+{
+public:
+    explicit MemorySourceTree(std::map<string, string> files): files(std::move(files)) {}
+
+    google::protobuf::io::ZeroCopyInputStream * Open(const string & filename) override;
+
+private:
+    std::map<string, string> files;
+};
+
+class Source
+{
+    using SourceTree = google::protobuf::compiler::SourceTree;
+    using DiskSourceTree = google::protobuf::compiler::DiskSourceTree;
+    using SourceTreeDescriptorDatabase = google::protobuf::compiler::SourceTreeDescriptorDatabase;
+    using DescriptorPool = google::protobuf::DescriptorPool;
+    using EncodedDescriptorDatabase = google::protobuf::EncodedDescriptorDatabase;
+    using FileDescriptor = google::protobuf::FileDescriptor;
+
+public:
+    Source();
+
+    // Prepares for importing any number of files into one shared pool,
+    // so that common imports are parsed only once.
+    // The root path is either a directory containing .proto files,
+    // or a serialized FileDescriptorSet, as written by 'protoc --descriptor_set_out'.
+    // A descriptor set is memory-mapped, and its files are built when imported.
+    explicit Source(const string & root_path);
+
+    // If a cache directory is given, the file is loaded from it when neither
+    // the file nor its imports changed since it was stored, and stored otherwise.
+    // If lazy, files loaded from descriptor sets, including the cache, are built without
+    // their imports, which are built once their types are used. Their type names are
+    // fully qualified, while those of .proto files are resolved with all imports built.
+    Source(const string & file_path, const string & root_path, const string & cache_dir = string(),
+           bool lazy = false);
+
+    // Imports files from the given source tree.
+    explicit Source(unique_ptr<SourceTree> source_tree);
+
+    Source(const string & file_path, unique_ptr<SourceTree> source_tree);
+
+    // Imports files from memory, given their contents by path.
+    explicit Source(std::map<string, string> files);
+
+    Source(const string & file_path, std::map<string, string> files);
+
+    // Imports files from the root path, or from the root directory
+    // as of the git revision, if it is not empty.
+    static Source at_revision(const string & root_path, const string & revision);
+
+    Source(Source && other);
+    ~Source();
+
+    const FileDescriptor * import(const string & file_path);
+
+    // Parses the files in 'jobs' threads, so that importing them later only builds them.
+    // Files that fail to parse, and imports not given, are parsed when imported,
+    // which reports their errors. Errors found when building files parsed in advance
+    // are reported without their line and column.
+    // Only directories and git revisions are parsed in parallel, reading them
+    // through a source tree per thread. Other sources ignore this.
+    void preparse(const std::vector<string> & file_paths, int jobs);
+
+    // Hands a file parsed before, such as one built by an earlier source of the same files,
+    // to the pool, so that importing it only builds it. Only sources of .proto files use it.
+    void add_parsed(const string & file_path, google::protobuf::FileDescriptorProto file);
+
+    const FileDescriptor * file_descriptor() const { return d_file_descriptor; }
+    const DescriptorPool * pool() const { return d_pool; }
+    // Whether the file was loaded from the cache.
+    bool from_cache() const { return d_from_cache; }
+
+private:
+    struct ParsedFiles;
+
+    void open(const string & root_path);
+    void open_directory(const string & root_dir);
+    void open_source_tree(unique_ptr<SourceTree> tree);
+    void load_descriptor_set(const string & path);
+    void close_descriptor_set();
+
+    // Sources of .proto files
+    unique_ptr<SourceTree> source_tree;
+    unique_ptr<ErrorCollector> error_collector;
+    unique_ptr<SourceTreeDescriptorDatabase> source_database;
+    unique_ptr<ParsedFiles> parsed_files;
+    // Creates source trees reading the same files, for parsing in parallel.
+    std::function<unique_ptr<SourceTree>()> make_source_tree;
+
+    // Sources of descriptor sets
+    unique_ptr<MappedFile> mapped_file;
+    unique_ptr<EncodedDescriptorDatabase> database;
+    unique_ptr<PoolErrorCollector> pool_error_collector;
+
+    // Pool of either kind of source
+    unique_ptr<DescriptorPool> descriptor_pool;
+
+    // Whether imports of descriptor sets are built on demand.
+    bool lazy = false;
+
+    const DescriptorPool * d_pool = nullptr;
+    const FileDescriptor * d_file_descriptor = nullptr;
+    bool d_from_cache = false;
+};
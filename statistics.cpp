@@ -0,0 +1,110 @@
+#include "statistics.h"
+
+#include <sys/resource.h>
+
+#include <iomanip>
+
+using namespace std;
+
+Statistics & Statistics::operator+=(const Statistics & other)
+{
+    load_time += other.load_time;
+    walk_time += other.walk_time;
+    compare_time += other.compare_time;
+    place_time += other.place_time;
+    trim_time += other.trim_time;
+    report_time += other.report_time;
+
+    types += other.types;
+    identical_types += other.identical_types;
+    fields += other.fields;
+    values += other.values;
+
+    memo_hits += other.memo_hits;
+    memo_misses += other.memo_misses;
+
+    sections_allocated += other.sections_allocated;
+    sections_retained += other.sections_retained;
+    items_allocated += other.items_allocated;
+    items_retained += other.items_retained;
+
+    return *this;
+}
+
+// In bytes, or 0 if unknown.
+static
+size_t peak_rss()
+{
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    // In kilobytes on Linux.
+    return size_t(usage.ru_maxrss) * 1024;
+}
+
+void Statistics::write(ostream & out, bool json) const
+{
+    const struct { const char * name; double time; } phases[] =
+    {
+        { "load", load_time },
+        { "walk", walk_time },
+        { "compare", compare_time },
+        { "place", place_time },
+        { "trim", trim_time },
+        { "report", report_time }
+    };
+
+    const struct { const char * name; size_t count; } counts[] =
+    {
+        { "types", types },
+        { "identical_types", identical_types },
+        { "fields", fields },
+        { "values", values },
+        { "memo_hits", memo_hits },
+        { "memo_misses", memo_misses },
+        { "sections_allocated", sections_allocated },
+        { "sections_retained", sections_retained },
+        { "items_allocated", items_allocated },
+        { "items_retained", items_retained },
+        { "peak_rss", peak_rss() }
+    };
+
+    if (json)
+    {
+        out << "{\"times\":{";
+        bool first = true;
+        for (auto & phase : phases)
+        {
+            if (!first)
+                out << ',';
+            first = false;
+            out << '"' << phase.name << "\":" << phase.time;
+        }
+        out << '}';
+        for (auto & count : counts)
+            out << ",\"" << count.name << "\":" << count.count;
+        out << '}';
+        return;
+    }
+
+    auto flags = out.flags();
+    out << fixed << setprecision(3);
+
+    out << "Time (ms):\n";
+    for (auto & phase : phases)
+        out << "  " << phase.name << ": " << phase.time * 1000 << '\n';
+
+    size_t lookups = memo_hits + memo_misses;
+    out << "Types: " << types << " compared, " << identical_types << " skipped as identical\n";
+    out << "Fields: " << fields << '\n';
+    out << "Values: " << values << '\n';
+    out << "Memo: " << lookups << " lookups, " << memo_hits << " hits";
+    if (lookups)
+        out << " (" << 100.0 * memo_hits / lookups << "%)";
+    out << '\n';
+    out << "Sections: " << sections_allocated << " allocated, " << sections_retained << " retained\n";
+    out << "Items: " << items_allocated << " allocated, " << items_retained << " retained\n";
+    out << "Peak RSS: " << peak_rss() / 1024 << " kB\n";
+
+    out.flags(flags);
+}
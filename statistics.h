@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+// Timings and counts of the phases of comparisons, summed over any number of them.
+struct Statistics
+{
+    // Wall time of each phase, in seconds.
+    double load_time = 0;
+    double walk_time = 0;
+    double compare_time = 0;
+    double place_time = 0;
+    double trim_time = 0;
+    double report_time = 0;
+
+    // Compared type pairs, and type pairs skipped as identical,
+    // counted once per declaration or field referring to them.
+    size_t types = 0;
+    size_t identical_types = 0;
+    // Fields and enum values of both types of compared pairs.
+    size_t fields = 0;
+    size_t values = 0;
+
+    // Lookups of type pairs in the memo, which found them already compared or not.
+    // Identical type pairs are skipped without a lookup.
+    size_t memo_hits = 0;
+    size_t memo_misses = 0;
+
+    // Sections and items of the result, before and after trimming.
+    // Only counted if requested in the options of the comparison.
+    size_t sections_allocated = 0;
+    size_t sections_retained = 0;
+    size_t items_allocated = 0;
+    size_t items_retained = 0;
+
+    Statistics & operator+=(const Statistics & other);
+
+    // Also writes the peak resident set size of the process so far.
+    // In JSON format, writes one object without a newline.
+    void write(std::ostream & out, bool json) const;
+};
+
+// Adds the wall time from construction to destruction to a total, in seconds.
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(double & total): total(total), start(std::chrono::steady_clock::now()) {}
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer & operator=(const PhaseTimer &) = delete;
+
+    ~PhaseTimer()
+    {
+        total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    double & total;
+    std::chrono::steady_clock::time_point start;
+};
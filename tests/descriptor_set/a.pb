@@ -0,0 +1,37 @@
+
+
+a.protoTest"i
+A$
+header (2.Test.HeaderRheader
+node (2
+.Test.NodeRnode
+kind (2
+.Test.KindRkind"X
+B$
+header (2.Test.HeaderRheader-
+	unchanged (2.Test.UnchangedR	unchanged"8
+Header
+id (Rid
+kind (2
+.Test.KindRkind"b
+Node
+next (2
+.Test.NodeRnext$
+header (2.Test.HeaderRheader
+value (Rvalue"
+	Unchanged
+s (	Rs">
+Tree
+weight (Rweight
+left (2
+.Test.TreeRleft"
+Mixed
+first (Rfirst$
+header (2.Test.HeaderRheader
+middle (Rmiddle
+kind (2
+.Test.KindRkind-
+	unchanged (2.Test.UnchangedR	unchanged*
+Kind
+K1
+K2
\ No newline at end of file
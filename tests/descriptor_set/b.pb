@@ -0,0 +1,35 @@
+
+
+b.protoTest"i
+A$
+header (2.Test.HeaderRheader
+node (2
+.Test.NodeRnode
+kind (2
+.Test.KindRkind"X
+B$
+header (2.Test.HeaderRheader-
+	unchanged (2.Test.UnchangedR	unchanged"8
+Header
+id (Rid
+kind (2
+.Test.KindRkind"L
+Node
+next (2
+.Test.NodeRnext$
+header (2.Test.HeaderRheader"
+	Unchanged
+s (	Rs"&
+Tree
+left (2
+.Test.TreeRleft"
+Mixed
+first (Rfirst$
+header (2.Test.HeaderRheader
+middle (Rmiddle"
+kind (2
+.Test.Kind:K3Rkind-
+	unchanged (2.Test.UnchangedR	unchanged*
+Kind
+K1
+K3
\ No newline at end of file
@@ -0,0 +1,21 @@
+
+g
+a_types.protoTest"8
+Header
+id (Rid
+kind (2
+.Test.KindRkind*
+Kind
+K1
+K2
+.
+a_unused.protoTest"
+Unused
+x (Rx
+
+a.protoTesta_types.protoa_unused.proto"9
+A$
+header (2.Test.HeaderRheader
+id (Rid"-
+Other$
+unused (2.Test.UnusedRunused
\ No newline at end of file
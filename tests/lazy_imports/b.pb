@@ -0,0 +1,22 @@
+
+o
+b_types.protoTest"8
+Header
+id (Rid
+kind (2
+.Test.KindRkind*
+Kind
+K1
+K2
+K3
+.
+b_unused.protoTest"
+Unused
+x (	Rx
+
+b.protoTestb_types.protob_unused.proto"9
+A$
+header (2.Test.HeaderRheader
+id (Rid"-
+Other$
+unused (2.Test.UnusedRunused
\ No newline at end of file
@@ -1,8 +1,22 @@
 #include "../json/json.hpp"
 #include "../comparison.h"
+#include "../batch.h"
+#include "../tree.h"
+#include "../matrix.h"
+#include "../watch.h"
+#include "../git.h"
+#include "../server.h"
+#include "../report.h"
+#include "../result_file.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <memory>
+#include <filesystem>
+#include <thread>
 
 using nlohmann::json;
 using namespace std;
@@ -15,77 +29,17 @@ void confirm(bool value, const string & what)
         throw std::runtime_error(what);
 }
 
-string section_type_string(Comparison::SectionType type)
-{
-    switch(type)
-    {
-    case Comparison::Root_Section:
-        return "/";
-    case Comparison::Message_Comparison:
-        return "message_comparison";
-    case Comparison::Message_Field_Comparison:
-        return "message_field_comparison";
-    case Comparison::Enum_Comparison:
-        return "enum_comparison";
-    case Comparison::Enum_Value_Comparison:
-        return "enum_value_comparison";
-    default:
-        throw std::runtime_error("Unexpected section type.");
-    }
-}
-
-string item_type_string(Comparison::ItemType type)
-{
-    switch (type)
-    {
-    case Comparison::Enum_Value_Name_Changed:
-        return "enum_value_name_changed";
-    case Comparison::Enum_Value_Id_Changed:
-        return "enum_value_id_changed";
-    case Comparison::Enum_Value_Added:
-        return "enum_value_added";
-    case Comparison::Enum_Value_Removed:
-        return "enum_value_removed";
-    case Comparison::Message_Field_Name_Changed:
-        return "message_field_name_changed";
-    case Comparison::Message_Field_Id_Changed:
-        return "message_field_id_changed";
-    case Comparison::Message_Field_Label_Changed:
-        return "message_field_label_changed";
-    case Comparison::Message_Field_Type_Changed:
-        return "message_field_type_changed";
-    case Comparison::Message_Field_Default_Value_Changed:
-        return "message_field_default_value_changed";
-    case Comparison::Message_Field_Added:
-        return "message_field_added";
-    case Comparison::Message_Field_Removed:
-        return "message_field_removed";
-    case Comparison::File_Message_Added:
-        return "file_message_added";
-    case Comparison::File_Message_Removed:
-        return "file_message_removed";
-    case Comparison::File_Enum_Added:
-        return "file_enum_added";
-    case Comparison::File_Enum_Removed:
-        return "file_enum_removed";
-    case Comparison::Name_Missing:
-        return "name_missing";
-    default:
-        throw std::runtime_error("Unexpected item type.");
-    }
-}
-
 void verify(const Comparison::Item & item, json & expected)
 {
     string expected_type = expected["type"];
     confirm(item_type_string(item.type) == expected_type,
-            "Item type " + item_type_string(item.type) + " = " + expected_type);
+            "Item type " + string(item_type_string(item.type)) + " = " + expected_type);
 
     string expected_a = expected["a"];
-    confirm(item.a == expected_a, "Item side A: '" + item.a + "' = '" + expected_a + "'");
+    confirm(item.a == expected_a, "Item side A: '" + string(item.a) + "' = '" + expected_a + "'");
 
     string expected_b = expected["b"];
-    confirm(item.b == expected_b, "Item side B: '" + item.b + "' = '" + expected_b + "'");
+    confirm(item.b == expected_b, "Item side B: '" + string(item.b) + "' = '" + expected_b + "'");
 }
 
 void verify(const Comparison::Section & section, json & expected)
@@ -145,76 +99,658 @@ void verify(const Comparison & comparison, json & expected)
     verify(comparison.root, expected);
 }
 
-int main(int argc, char * argv[])
+bool load_expected(const string & test_path, json & expected)
 {
-    if (argc < 2)
+    try
     {
-        cerr << "Expected argument: <test directory>" << endl;
-        return 1;
+        string diff_path = test_path + "/diff.json";
+        ifstream diff_file(diff_path);
+        if (!diff_file.is_open())
+        {
+            cerr << "Failed to open diff file: " << diff_path << endl;
+            return false;
+        }
+
+        diff_file >> expected;
+    }
+    catch (json::exception & e)
+    {
+        cerr << "Failed to parse diff file: " << e.what() << endl;
+        return false;
     }
 
-    string test_path(argv[1]);
+    return true;
+}
 
-    Comparison::Options options;
+// Verifies the comparison and its JSON output against the expected result.
+bool check(Comparison & comparison, json & expected)
+{
+    comparison.root.trim();
 
-    if (argc > 2)
+    comparison.root.print();
+
+    try
     {
-        for (int i = 2; i < argc; ++i)
+        verify(comparison, expected);
+    }
+    catch (std::exception & e)
+    {
+        cerr << "Failed to verify: " << e.what() << endl;
+        return false;
+    }
+
+    try
+    {
+        ostringstream json_output;
+        JsonReporter reporter(json_output);
+        comparison.report(reporter);
+
+        auto reported = json::parse(json_output.str());
+        verify(comparison, reported);
+    }
+    catch (std::exception & e)
+    {
+        cerr << "Failed to verify JSON output: " << e.what() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Compares the directories 'a' and 'b' in the test directory.
+// The expected result lists added and removed files, and the result of each common file.
+int run_tree_test(const string & test_path, const Comparison::Options & options, int jobs)
+{
+    json expected;
+    if (!load_expected(test_path, expected))
+        return 1;
+
+    bool ok = true;
+
+    try
+    {
+        Tree tree(test_path + "/a", test_path + "/b");
+
+        confirm(json(tree.removed_files()) == expected["removed_files"], "Removed files.");
+        confirm(json(tree.added_files()) == expected["added_files"], "Added files.");
+        confirm(tree.common_files().size() == expected["files"].size(),
+                "Number of common files = " + to_string(expected["files"].size()));
+
+        tree.compare(options, jobs, [&](const string & file, Comparison * comparison, const string & error)
         {
-            string arg = argv[i];
-            if (arg == "--binary")
+            cerr << "File: " << file << endl;
+            if (!comparison)
             {
-                options.binary = true;
+                cerr << "Error while comparing: " << error << endl;
+                ok = false;
+            }
+            else if (!expected["files"].count(file))
+            {
+                cerr << "Unexpected file: " << file << endl;
+                ok = false;
             }
             else
             {
-                cerr << "Unknown option: " << arg << endl;
-                return 1;
+                ok &= check(*comparison, expected["files"][file]);
+            }
+        });
+    }
+    catch (std::exception & e)
+    {
+        cerr << "Error while comparing: " << e.what() << endl;
+        return 1;
+    }
+
+    if (!ok)
+        return 1;
+
+    cerr << "OK." << endl;
+    return 0;
+}
+
+// Decides whether there are breaking changes with and without a full result,
+// and confirms that both agree with the expected verdict.
+int run_verdict_test(const string & test_path, Comparison::Options options, bool expected)
+{
+    try
+    {
+        Source source_a("a.proto", test_path);
+        Source source_b("b.proto", test_path);
+
+        for (bool verdict_only : { true, false })
+        {
+            options.verdict_only = verdict_only;
+            Comparison comparison(options);
+            comparison.compare(source_a, source_b);
+
+            confirm(comparison.breaking() == expected,
+                    string(verdict_only ? "Verdict" : "Full comparison") + " is " +
+                    (expected ? "breaking." : "compatible."));
+
+            if (verdict_only)
+            {
+                comparison.root.trim();
+                confirm(comparison.root.subsections.empty(), "No sections in verdict.");
             }
         }
     }
+    catch (std::exception & e)
+    {
+        cerr << "Failed to verify: " << e.what() << endl;
+        return 1;
+    }
 
-    Comparison comparison(options);
+    cerr << "OK." << endl;
+    return 0;
+}
+
+static
+string report_json(Comparison & comparison)
+{
+    ostringstream output;
+    JsonReporter reporter(output);
+    comparison.report(reporter);
+    return output.str();
+}
+
+// Decides whether each type is breaking with the second file as the baseline, and confirms
+// that it agrees with a verdict on that type alone, and that the baseline does not change results.
+// Then compares the baseline with the first file and itself as versions in the directory,
+// which are the columns of the expected matrix.
+int run_matrix_test(const string & test_path, Comparison::Options options, const string & matrix_dir)
+{
+    try
+    {
+        Source source_a("a.proto", test_path);
+        Source source_b("b.proto", test_path);
+
+        Comparison::Baseline baseline(source_b.file_descriptor(), options);
+
+        Comparison comparison(options, &baseline);
+        auto results = comparison.compare_types(source_a.file_descriptor(), source_b.file_descriptor());
+        confirm(!results.empty(), "Types are compared.");
+
+        auto & pool_a = *source_a.pool();
+        auto & pool_b = *source_b.pool();
+
+        for (auto & result : results)
+        {
+            string name(result.name);
+            bool in_a = pool_a.FindMessageTypeByName(name) or pool_a.FindEnumTypeByName(name);
+            bool in_b = pool_b.FindMessageTypeByName(name) or pool_b.FindEnumTypeByName(name);
+
+            if (result.status == Comparison::Type_Added or result.status == Comparison::Type_Removed)
+            {
+                bool added = result.status == Comparison::Type_Added;
+                confirm(in_a != added and in_b == added, name + (added ? " is added." : " is removed."));
+                continue;
+            }
+
+            Comparison::Options verdict_options = options;
+            verdict_options.verdict_only = true;
+            Comparison verdict(verdict_options);
+            verdict.compare(source_a, name, source_b, name);
+
+            confirm(verdict.breaking() == (result.status == Comparison::Type_Breaking),
+                    name + " is " + Matrix::status_string(result.status) + ".");
+        }
+
+        Comparison plain(options);
+        plain.compare(source_a, source_b);
+        Comparison with_baseline(options, &baseline);
+        with_baseline.compare(source_a, source_b);
+        confirm(report_json(plain) == report_json(with_baseline), "Baseline does not change the result.");
+
+        filesystem::remove_all(matrix_dir);
+        for (auto & [version, file] : { pair("base", "b.proto"), pair("v1", "a.proto"), pair("v2", "b.proto") })
+        {
+            filesystem::create_directories(matrix_dir + "/" + version);
+            filesystem::copy_file(test_path + "/" + file, matrix_dir + "/" + version + "/x.proto");
+        }
+
+        Matrix matrix(matrix_dir + "/base", "x.proto", options);
+        matrix.compare({ matrix_dir + "/v1", matrix_dir + "/v2", matrix_dir + "/missing" }, options.jobs);
+
+        confirm(matrix.errors()[0].empty() and matrix.errors()[1].empty(), "Versions are loaded.");
+        confirm(!matrix.errors()[2].empty(), "Missing version fails to load.");
+        confirm(matrix.rows().size() == results.size(), "One row per type.");
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            auto & row = matrix.rows()[i];
+            confirm(row.type == results[i].name and row.results[0] == results[i].status,
+                    row.type + " in the first version matches.");
+            bool in_b = results[i].status != Comparison::Type_Removed;
+            confirm(row.results[1] == (in_b ? optional(Comparison::Type_Compatible) : nullopt),
+                    row.type + " in the baseline itself is compatible.");
+            confirm(!row.results[2], row.type + " in the missing version is unknown.");
+        }
+
+        confirm(matrix.breaking() == comparison.breaking(), "Matrix verdict matches.");
+    }
+    catch (std::exception & e)
+    {
+        cerr << "Failed to verify: " << e.what() << endl;
+        return 1;
+    }
+
+    cerr << "OK." << endl;
+    return 0;
+}
+
+// Compares one type of the descriptor sets 'a.pb' and 'b.pb', built with their imports and lazily,
+// and confirms that lazily built sources only build the imports the type refers to.
+// Each file imports 'a_types.proto' or 'b_types.proto' for the type, and 'a_unused.proto' or 'b_unused.proto'.
+int run_lazy_test(const string & test_path, const Comparison::Options & options, const string & type)
+{
+    json expected;
+    if (!load_expected(test_path, expected))
+        return 1;
+
+    for (bool lazy : { false, true })
+    {
+        Comparison comparison(options);
+
+        try
+        {
+            Source source_a("a.proto", test_path + "/a.pb", "", lazy);
+            Source source_b("b.proto", test_path + "/b.pb", "", lazy);
+
+            if (lazy)
+            {
+                confirm(!source_a.pool()->InternalIsFileLoaded("a_types.proto"), "Imports of A not built.");
+                confirm(!source_b.pool()->InternalIsFileLoaded("b_types.proto"), "Imports of B not built.");
+            }
+
+            comparison.compare(source_a, type, source_b, type);
+
+            confirm(source_a.pool()->InternalIsFileLoaded("a_types.proto") and
+                    source_b.pool()->InternalIsFileLoaded("b_types.proto"), "Used imports built.");
+            confirm(source_a.pool()->InternalIsFileLoaded("a_unused.proto") != lazy and
+                    source_b.pool()->InternalIsFileLoaded("b_unused.proto") != lazy,
+                    lazy ? "Unused imports not built." : "Unused imports built.");
+
+            if (!check(comparison, expected))
+                return 1;
+        }
+        catch (std::exception & e)
+        {
+            cerr << "Failed to verify: " << e.what() << endl;
+            return 1;
+        }
+    }
+
+    cerr << "OK." << endl;
+    return 0;
+}
+
+// Writes the result of comparing 'a.proto' and 'b.proto' to a result file, and confirms that
+// reading it reports the same as the comparison, in whole and for each compared type.
+int run_result_file_test(const string & test_path, const Comparison::Options & options, const string & result_path)
+{
+    json expected;
+    if (!load_expected(test_path, expected))
+        return 1;
 
     try
     {
         Source source_a("a.proto", test_path);
         Source source_b("b.proto", test_path);
+
+        Comparison comparison(options);
         comparison.compare(source_a, source_b);
+        if (!check(comparison, expected))
+            return 1;
+
+        filesystem::create_directories(filesystem::path(result_path).parent_path());
+        {
+            ofstream out(result_path, ios::binary);
+            BinaryReporter reporter(out);
+            comparison.report(reporter);
+            confirm(bool(out), "Result file written.");
+        }
+
+        ResultFile file(result_path);
+
+        ostringstream text, read_text;
+        TextReporter text_reporter(text), read_text_reporter(read_text);
+        comparison.root.report(text_reporter);
+        file.report(read_text_reporter);
+        confirm(read_text.str() == text.str(), "Text read from result file matches.");
+
+        ostringstream output, read_output;
+        JsonReporter reporter(output), read_reporter(read_output);
+        comparison.root.report(reporter);
+        file.report(read_reporter);
+        confirm(read_output.str() == output.str(), "JSON read from result file matches.");
+
+        auto types = file.types();
+        confirm(std::is_sorted(types.begin(), types.end()), "Types are sorted.");
+        confirm(types.size() == comparison.root.subsections.size(), "One type per section.");
+
+        for (auto & section : comparison.root.subsections)
+        {
+            ostringstream type_output, read_type_output;
+            JsonReporter type_reporter(type_output), read_type_reporter(read_type_output);
+            section.report(type_reporter);
+            confirm(file.report(section.a, read_type_reporter), "Type found: " + string(section.a));
+            confirm(read_type_output.str() == type_output.str(), "Type read from result file matches.");
+        }
+
+        ostringstream missing_output;
+        JsonReporter missing_reporter(missing_output);
+        confirm(!file.report("Missing.Type", missing_reporter) and missing_output.str().empty(),
+                "Missing type not found.");
     }
     catch (std::exception & e)
     {
-        cerr << "Error while comparing: " << e.what() << endl;
+        cerr << "Failed to verify: " << e.what() << endl;
         return 1;
     }
 
-    comparison.root.trim();
+    cerr << "OK." << endl;
+    return 0;
+}
 
-    comparison.root.print();
+// Interns the names and field numbers of the files 'a.proto' and 'b.proto' in 'jobs' threads
+// at once, and confirms that each name and number is stored once, with the same text.
+int run_name_table_test(const string & test_path, int jobs)
+{
+    try
+    {
+        Source source_a("a.proto", test_path);
+        Source source_b("b.proto", test_path);
+
+        vector<string> texts;
+        vector<int> numbers;
+        for (auto * file : { source_a.file_descriptor(), source_b.file_descriptor() })
+        {
+            for (int i = 0; i < file->message_type_count(); ++i)
+            {
+                auto * message = file->message_type(i);
+                texts.push_back(message->full_name());
+                for (int j = 0; j < message->field_count(); ++j)
+                {
+                    texts.push_back(message->field(j)->name());
+                    numbers.push_back(message->field(j)->number());
+                }
+            }
+        }
+        confirm(!texts.empty(), "Files have names.");
+
+        NameTable names;
+        vector<vector<string_view>> interned(std::max(jobs, 1));
+        vector<thread> threads;
+        for (auto & views : interned)
+        {
+            threads.emplace_back([&]
+            {
+                for (auto & text : texts)
+                    views.push_back(names.intern(string(text)));
+                for (int number : numbers)
+                    views.push_back(names.number(number));
+            });
+        }
+        for (auto & thread : threads)
+            thread.join();
+
+        for (size_t i = 0; i < texts.size(); ++i)
+        {
+            for (auto & views : interned)
+            {
+                confirm(views[i] == texts[i], "Interned " + texts[i]);
+                confirm(views[i].data() == interned.front()[i].data(), "Name " + texts[i] + " is stored once.");
+            }
+            confirm(names.intern(texts[i]).data() == interned.front()[i].data(), "Name " + texts[i] + " is stable.");
+        }
+
+        for (size_t i = 0; i < numbers.size(); ++i)
+        {
+            auto number = to_string(numbers[i]);
+            for (auto & views : interned)
+            {
+                auto view = views[texts.size() + i];
+                confirm(view == number, "Number " + number);
+                confirm(view.data() == interned.front()[texts.size() + i].data(), "Number " + number + " is stored once.");
+            }
+            confirm(names.number(numbers[i]).data() == interned.front()[texts.size() + i].data(),
+                    "Number " + number + " is stable.");
+        }
+        confirm(names.intern("").empty(), "Empty name is empty.");
+    }
+    catch (std::exception & e)
+    {
+        cerr << "Failed to verify: " << e.what() << endl;
+        return 1;
+    }
+
+    cerr << "OK." << endl;
+    return 0;
+}
 
+// Watches a copy of the directory 'a', compared with 'a' itself, then copies the files of 'b'
+// over it, and confirms that only they are found changed and the update matches the expected result.
+// Files of 'a' importing those of 'b' refer to their types, so they must be parsed again.
+int run_watch_test(const string & test_path, const Comparison::Options & options, const string & watch_dir)
+{
     json expected;
+    if (!load_expected(test_path, expected))
+        return 1;
+
+    // Copies the files of the directory over those being watched.
+    auto copy_files = [&](const string & dir)
+    {
+        vector<string> files;
+        for (auto & entry : filesystem::recursive_directory_iterator(dir))
+        {
+            if (!entry.is_regular_file())
+                continue;
+            string file = entry.path().lexically_relative(dir).generic_string();
+            filesystem::create_directories(filesystem::path(watch_dir + "/" + file).parent_path());
+            filesystem::copy_file(entry.path(), watch_dir + "/" + file, filesystem::copy_options::overwrite_existing);
+            files.push_back(file);
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    };
 
     try
     {
-        string diff_path = test_path + "/diff.json";
-        ifstream diff_file(diff_path);
-        if (!diff_file.is_open())
+        filesystem::remove_all(watch_dir);
+        filesystem::create_directories(watch_dir);
+        copy_files(test_path + "/a");
+
+        Watch watch(test_path + "/a", "main.proto", "", watch_dir, "main.proto", ".", options);
+        watch.start();
+
+        auto & unchanged = watch.update({});
+        unchanged.root.trim();
+        confirm(unchanged.root.is_empty(), "Copy has no changes.");
+
+        auto files = copy_files(test_path + "/b");
+        auto changed = watch.wait(5000);
+        confirm(changed == files, "Copied files changed.");
+
+        if (!check(watch.update(changed), expected))
+            return 1;
+
+        changed = watch.wait(100);
+        confirm(changed.empty(), "Nothing else changed.");
+
+        copy_files(test_path + "/a");
+        auto & restored = watch.update(watch.wait(5000));
+        restored.root.trim();
+        confirm(restored.root.is_empty(), "Restored copy has no changes.");
+
+        // Replaces the directories of the files by those of 'b', moving them away and in.
+        string moved_dir = watch_dir + ".moved";
+        string old_dir = watch_dir + ".old";
+        filesystem::remove_all(moved_dir);
+        filesystem::remove_all(old_dir);
+        filesystem::copy(test_path + "/b", moved_dir, filesystem::copy_options::recursive);
+        filesystem::create_directories(old_dir);
+
+        vector<string> directories;
+        for (auto & entry : filesystem::directory_iterator(moved_dir))
+            directories.push_back(entry.path().filename().string());
+        for (auto & directory : directories)
         {
-            cerr << "Failed to open diff file: " << diff_path << endl;
+            filesystem::rename(watch_dir + "/" + directory, old_dir + "/" + directory);
+            filesystem::rename(moved_dir + "/" + directory, watch_dir + "/" + directory);
+        }
+
+        changed = watch.wait(5000);
+        confirm(changed == files, "Files of moved directories changed.");
+        if (!check(watch.update(changed), expected))
             return 1;
+
+        for (auto & entry : filesystem::recursive_directory_iterator(old_dir))
+        {
+            if (entry.is_regular_file())
+                filesystem::copy_file(entry.path(), entry.path().string() + ".proto");
         }
+        changed = watch.wait(100);
+        confirm(changed.empty(), "Directories moved away are not watched.");
 
-        diff_file >> expected;
+        copy_files(test_path + "/a");
+        auto & restored_moved = watch.update(watch.wait(5000));
+        restored_moved.root.trim();
+        confirm(restored_moved.root.is_empty(), "Moved directories are watched.");
     }
-    catch (json::exception & e)
+    catch (std::exception & e)
     {
-        cerr << "Failed to parse diff file: " << e.what() << endl;
+        cerr << "Failed to verify: " << e.what() << endl;
         return 1;
     }
 
+    cerr << "OK." << endl;
+    return 0;
+}
+
+// Compares the common files of the directories 'a' and 'b' in a batch, after parsing all of them
+// in advance in 'jobs' threads per directory, and confirms that the results are the same as with
+// files imported one by one. If a git directory is given, both directories are committed to
+// a repository there, and read as of that commit.
+int run_preparse_test(const string & test_path, const Comparison::Options & options, const string & git_dir)
+{
+    string root_dir = test_path;
+    string revision;
+
     try
     {
-        verify(comparison, expected);
+        if (!git_dir.empty())
+        {
+            filesystem::remove_all(git_dir);
+            filesystem::create_directories(git_dir);
+            filesystem::copy(test_path + "/a", git_dir + "/a", filesystem::copy_options::recursive);
+            filesystem::copy(test_path + "/b", git_dir + "/b", filesystem::copy_options::recursive);
+
+            string git = "git -C " + git_dir + " ";
+            confirm(system((git + "init -q && " + git + "add a b && " + git +
+                            "-c user.name=test -c user.email=test@test commit -q -m tree").c_str()) == 0,
+                    "Committed directories.");
+            // Files are read from the commit only.
+            filesystem::remove_all(git_dir + "/a/sub");
+            filesystem::remove_all(git_dir + "/b/sub");
+
+            root_dir = git_dir;
+            revision = "HEAD";
+        }
+
+        vector<Batch::Entry> entries;
+        for (auto & file : Tree::find_files(test_path + "/a"))
+        {
+            if (filesystem::exists(test_path + "/b/" + file))
+                entries.push_back({ file, file, "." });
+        }
+        confirm(entries.size() > 1, "Several files to parse.");
+
+        Batch serial(root_dir + "/a", root_dir + "/b", revision, revision);
+        Batch parallel(root_dir + "/a", root_dir + "/b", revision, revision);
+        parallel.preparse(entries, options.jobs);
+
+        for (auto & entry : entries)
+        {
+            ostringstream expected, output;
+            JsonReporter expected_reporter(expected), reporter(output);
+
+            Comparison expected_comparison(options);
+            serial.compare(entry, expected_comparison);
+            expected_comparison.report(expected_reporter);
+
+            Comparison comparison(options);
+            parallel.compare(entry, comparison);
+            comparison.report(reporter);
+
+            cerr << entry.file1 << ": " << output.str() << endl;
+            confirm(output.str() == expected.str(), "Result matches serial import: " + entry.file1);
+        }
+    }
+    catch (std::exception & e)
+    {
+        cerr << "Failed to verify: " << e.what() << endl;
+        return 1;
+    }
+
+    cerr << "OK." << endl;
+    return 0;
+}
+
+// Removes the references, which are not in the expected results.
+void remove_references(json & section)
+{
+    section.erase("references");
+    section.erase("reference_count");
+    for (auto & subsection : section["sections"])
+        remove_references(subsection);
+    if (section["sections"].is_null())
+        section.erase("sections");
+}
+
+// Sends the same request twice to a server with 'a.proto' as the baseline,
+// so the second one uses the baseline imported by the first.
+int run_server_test(const string & test_path, const Comparison::Options & options)
+{
+    json expected;
+    if (!load_expected(test_path, expected))
+        return 1;
+
+    try
+    {
+        Server server(test_path, "", options, true);
+
+        for (int i = 0; i < 2; ++i)
+        {
+            string response = server.respond("a.proto " + test_path + " b.proto .");
+            cerr << response;
+
+            string status = "OK\n";
+            confirm(response.compare(0, status.size(), status) == 0, "Response status is OK.");
+
+            auto result = json::parse(response.substr(status.size()));
+            remove_references(result);
+            confirm(result == expected, "Response matches expected result.");
+        }
+
+        auto response = server.respond("a.proto");
+        confirm(response.compare(0, 6, "ERROR\n") == 0, "Invalid request is rejected.");
+
+        // Types of files imported by other requests are not those of file1.
+        Source source_a("a.proto", test_path);
+        Source source_b("b.proto", test_path);
+        auto * file_b = source_b.file_descriptor();
+        for (int i = 0; i < file_b->message_type_count(); ++i)
+        {
+            string type = file_b->message_type(i)->full_name();
+            if (source_a.pool()->FindMessageTypeByName(type))
+                continue;
+
+            response = server.respond("b.proto " + test_path + " b.proto " + type);
+            confirm(response.compare(0, 3, "OK\n") == 0, "Type of b.proto is found.");
+            response = server.respond("a.proto " + test_path + " b.proto " + type);
+            cerr << response;
+            confirm(response.compare(0, 6, "ERROR\n") == 0, "Type of another file is rejected.");
+        }
     }
     catch (std::exception & e)
     {
@@ -222,5 +758,341 @@ int main(int argc, char * argv[])
         return 1;
     }
 
+    cerr << "OK." << endl;
+    return 0;
+}
+
+// Counts the sections below the given expected one and their items.
+void count_expected(json & expected, size_t & sections, size_t & items)
+{
+    if (expected.count("items"))
+        items += expected["items"].size();
+
+    if (expected.count("sections"))
+    {
+        sections += expected["sections"].size();
+        for (auto & section : expected["sections"])
+            count_expected(section, sections, items);
+    }
+}
+
+// Verifies the statistics of the comparison against the size of the expected result.
+int run_statistics_test(const string & test_path, Comparison::Options options)
+{
+    json expected;
+    if (!load_expected(test_path, expected))
+        return 1;
+
+    size_t expected_sections = 0;
+    size_t expected_items = 0;
+    count_expected(expected, expected_sections, expected_items);
+
+    options.statistics = true;
+
+    try
+    {
+        Source source_a("a.proto", test_path);
+        Source source_b("b.proto", test_path);
+
+        Comparison comparison(options);
+        comparison.compare(source_a, source_b);
+
+        ostringstream output;
+        TextReporter reporter(output);
+        comparison.report(reporter);
+
+        auto statistics = comparison.statistics();
+        statistics.write(cerr, false);
+
+        confirm(statistics.types == statistics.memo_misses, "Each type pair compared once.");
+        confirm(statistics.sections_retained == expected_sections,
+                "Retained sections = " + to_string(expected_sections));
+        confirm(statistics.items_retained == expected_items,
+                "Retained items = " + to_string(expected_items));
+        confirm(statistics.sections_allocated >= statistics.sections_retained, "Sections allocated before trimming.");
+        confirm(statistics.items_allocated >= statistics.items_retained, "Items allocated before trimming.");
+    }
+    catch (std::exception & e)
+    {
+        cerr << "Failed to verify statistics: " << e.what() << endl;
+        return 1;
+    }
+
+    cerr << "OK." << endl;
+    return 0;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Expected argument: <test directory>" << endl;
+        return 1;
+    }
+
+    string test_path(argv[1]);
+
+    Comparison::Options options;
+    bool use_batch = false;
+    bool use_preparse = false;
+    bool use_tree = false;
+    bool use_preparse_tree = false;
+    bool use_server = false;
+    string expected_verdict;
+    bool use_statistics = false;
+    bool use_descriptor_sets = false;
+    bool use_memory = false;
+    bool use_names = false;
+    string cache_dir;
+    string git_dir;
+    string matrix_dir;
+    string lazy_type;
+    string result_path;
+    string items;
+    string watch_dir;
+
+    if (argc > 2)
+    {
+        for (int i = 2; i < argc; ++i)
+        {
+            string arg = argv[i];
+            if (arg == "--binary")
+            {
+                options.binary = true;
+            }
+            else if (arg == "--jobs" and i + 1 < argc)
+            {
+                options.jobs = atoi(argv[++i]);
+            }
+            else if (arg == "--max-references" and i + 1 < argc)
+            {
+                options.max_references = atoi(argv[++i]);
+            }
+            else if (arg == "--top-level-only")
+            {
+                options.nested_types = false;
+            }
+            else if (arg == "--skip-identical")
+            {
+                options.skip_identical = true;
+            }
+            else if (arg == "--no-skip-identical")
+            {
+                options.skip_identical = false;
+            }
+            else if (arg == "--check-fingerprints")
+            {
+                options.check_fingerprints = true;
+            }
+            else if (arg == "--watch" and i + 1 < argc)
+            {
+                watch_dir = argv[++i];
+            }
+            else if (arg == "--only" and i + 1 < argc)
+            {
+                items = argv[++i];
+            }
+            else if (arg == "--batch")
+            {
+                use_batch = true;
+            }
+            else if (arg == "--preparse")
+            {
+                use_preparse = true;
+            }
+            else if (arg == "--verdict" and i + 1 < argc)
+            {
+                expected_verdict = argv[++i];
+            }
+            else if (arg == "--statistics")
+            {
+                use_statistics = true;
+            }
+            else if (arg == "--server")
+            {
+                use_server = true;
+            }
+            else if (arg == "--preparse-tree")
+            {
+                use_preparse_tree = true;
+            }
+            else if (arg == "--tree")
+            {
+                use_tree = true;
+            }
+            else if (arg == "--memory")
+            {
+                use_memory = true;
+            }
+            else if (arg == "--names")
+            {
+                use_names = true;
+            }
+            else if (arg == "--descriptor-sets")
+            {
+                use_descriptor_sets = true;
+            }
+            else if (arg == "--cache-dir" and i + 1 < argc)
+            {
+                cache_dir = argv[++i];
+            }
+            else if (arg == "--git" and i + 1 < argc)
+            {
+                git_dir = argv[++i];
+            }
+            else if (arg == "--matrix" and i + 1 < argc)
+            {
+                matrix_dir = argv[++i];
+            }
+            else if (arg == "--lazy" and i + 1 < argc)
+            {
+                lazy_type = argv[++i];
+            }
+            else if (arg == "--result-file" and i + 1 < argc)
+            {
+                result_path = argv[++i];
+            }
+            else
+            {
+                cerr << "Unknown option: " << arg << endl;
+                return 1;
+            }
+        }
+    }
+
+    if (!items.empty())
+        options.items = parse_item_types(items, options.binary);
+
+    if (use_preparse_tree)
+        return run_preparse_test(test_path, options, git_dir);
+
+    if (use_tree)
+        return run_tree_test(test_path, options, options.jobs);
+
+    if (use_server)
+        return run_server_test(test_path, options);
+
+    if (use_names)
+        return run_name_table_test(test_path, options.jobs);
+
+    if (use_statistics)
+        return run_statistics_test(test_path, options);
+
+    if (!lazy_type.empty())
+        return run_lazy_test(test_path, options, lazy_type);
+
+    if (!watch_dir.empty())
+        return run_watch_test(test_path, options, watch_dir);
+
+    if (!result_path.empty())
+        return run_result_file_test(test_path, options, result_path);
+
+    if (!matrix_dir.empty())
+        return run_matrix_test(test_path, options, matrix_dir);
+
+    if (!expected_verdict.empty())
+        return run_verdict_test(test_path, options, expected_verdict == "breaking");
+
+    // The sources must outlive the comparison, which refers to their names.
+    unique_ptr<Batch> batch;
+    unique_ptr<Source> source_a;
+    unique_ptr<Source> source_b;
+
+    Comparison comparison(options);
+
+    try
+    {
+        if (use_batch)
+        {
+            batch = make_unique<Batch>(test_path, test_path);
+            Batch::Entry entry { "a.proto", "b.proto", "." };
+            if (use_preparse)
+                batch->preparse({ entry }, options.jobs);
+            batch->compare(entry, comparison);
+        }
+        else if (use_descriptor_sets)
+        {
+            source_a = make_unique<Source>("a.proto", test_path + "/a.pb");
+            source_b = make_unique<Source>("b.proto", test_path + "/b.pb");
+            comparison.compare(*source_a, *source_b);
+        }
+        else if (use_memory)
+        {
+            auto read = [&](const string & name)
+            {
+                ifstream file(test_path + "/" + name);
+                ostringstream contents;
+                contents << file.rdbuf();
+                return contents.str();
+            };
+
+            source_a = make_unique<Source>("a.proto", map<string, string> { { "a.proto", read("a.proto") } });
+            source_b = make_unique<Source>("b.proto", map<string, string> { { "b.proto", read("b.proto") } });
+            comparison.compare(*source_a, *source_b);
+        }
+        else if (!git_dir.empty())
+        {
+            // Commit both versions as the same file, remove the file,
+            // and compare the two commits.
+            filesystem::remove_all(git_dir);
+            filesystem::create_directories(git_dir);
+
+            string git = "git -C " + git_dir + " ";
+            string commit = git + "-c user.name=test -c user.email=test@test commit -q -m ";
+            string file = git_dir + "/x.proto";
+
+            confirm(system((git + "init -q").c_str()) == 0, "Created git repository.");
+            filesystem::copy_file(test_path + "/a.proto", file);
+            confirm(system((git + "add x.proto && " + commit + "a").c_str()) == 0, "Committed A.");
+            filesystem::copy_file(test_path + "/b.proto", file, filesystem::copy_options::overwrite_existing);
+            confirm(system((git + "add x.proto && " + commit + "b").c_str()) == 0, "Committed B.");
+            filesystem::remove(file);
+
+            // A response naming a long missing file is read entirely, before the next one.
+            GitSourceTree tree(git_dir, "HEAD");
+            confirm(!unique_ptr<google::protobuf::io::ZeroCopyInputStream>(tree.Open(string(2000, 'x') + ".proto")),
+                    "Long missing name not found.");
+            confirm(bool(unique_ptr<google::protobuf::io::ZeroCopyInputStream>(tree.Open("x.proto"))),
+                    "File found after long missing name.");
+
+            source_a = make_unique<Source>("x.proto", make_unique<GitSourceTree>(git_dir, "HEAD~1"));
+            source_b = make_unique<Source>("x.proto", make_unique<GitSourceTree>(git_dir, "HEAD"));
+            comparison.compare(*source_a, *source_b);
+        }
+        else if (!cache_dir.empty())
+        {
+            // Compare sources loaded from the cache stored by the first import.
+            filesystem::remove_all(cache_dir);
+
+            confirm(!Source("a.proto", test_path, cache_dir).from_cache(), "Source A stored in cache.");
+            confirm(!Source("b.proto", test_path, cache_dir).from_cache(), "Source B stored in cache.");
+
+            source_a = make_unique<Source>("a.proto", test_path, cache_dir);
+            source_b = make_unique<Source>("b.proto", test_path, cache_dir);
+            confirm(source_a->from_cache(), "Source A loaded from cache.");
+            confirm(source_b->from_cache(), "Source B loaded from cache.");
+
+            comparison.compare(*source_a, *source_b);
+        }
+        else
+        {
+            source_a = make_unique<Source>("a.proto", test_path);
+            source_b = make_unique<Source>("b.proto", test_path);
+            comparison.compare(*source_a, *source_b);
+        }
+    }
+    catch (std::exception & e)
+    {
+        cerr << "Error while comparing: " << e.what() << endl;
+        return 1;
+    }
+
+    json expected;
+    if (!load_expected(test_path, expected))
+        return 1;
+
+    if (!check(comparison, expected))
+        return 1;
+
     cerr << "OK." << endl;
 }
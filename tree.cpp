@@ -0,0 +1,148 @@
+#include "tree.h"
+#include "git.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+vector<string> Tree::find_files(const string & root_dir)
+{
+    vector<string> files;
+
+    for (auto & entry : filesystem::recursive_directory_iterator(root_dir))
+    {
+        if (entry.is_regular_file() and entry.path().extension() == ".proto")
+            files.push_back(entry.path().lexically_relative(root_dir).generic_string());
+    }
+
+    std::sort(files.begin(), files.end());
+
+    return files;
+}
+
+Tree::Tree(const string & root_dir1, const string & root_dir2,
+           const string & revision1, const string & revision2):
+    source1(Source::at_revision(root_dir1, revision1)),
+    source2(Source::at_revision(root_dir2, revision2))
+{
+    auto files1 = revision1.empty() ? find_files(root_dir1) : GitSourceTree::find_files(root_dir1, revision1);
+    auto files2 = revision2.empty() ? find_files(root_dir2) : GitSourceTree::find_files(root_dir2, revision2);
+
+    std::set_difference(files1.begin(), files1.end(), files2.begin(), files2.end(),
+                        back_inserter(removed));
+    std::set_difference(files2.begin(), files2.end(), files1.begin(), files1.end(),
+                        back_inserter(added));
+    std::set_intersection(files1.begin(), files1.end(), files2.begin(), files2.end(),
+                          back_inserter(common));
+}
+
+void Tree::compare(const Comparison::Options & options, int jobs, const Report & report)
+{
+    struct Task
+    {
+        const FileDescriptor * file1 = nullptr;
+        const FileDescriptor * file2 = nullptr;
+        // Errors of importing either file, in separate threads.
+        string error1;
+        string error2;
+        string error;
+        unique_ptr<Comparison> comparison;
+        bool done = false;
+    };
+
+    vector<Task> tasks(common.size());
+
+    // Sources are not thread-safe, but the imported descriptors are.
+    // Each side is parsed in parallel, then imported in its own thread.
+
+    {
+        PhaseTimer timer(d_load_time);
+
+        std::thread parsing([&]{ source1.preparse(common, jobs); });
+        source2.preparse(common, jobs);
+        parsing.join();
+
+        auto import = [&](Source & source, const FileDescriptor * Task::*file, string Task::*error)
+        {
+            for (size_t i = 0; i < common.size(); ++i)
+            {
+                try
+                {
+                    tasks[i].*file = source.import(common[i]);
+                }
+                catch (std::exception & e)
+                {
+                    tasks[i].*error = e.what();
+                }
+            }
+        };
+
+        std::thread importing(import, std::ref(source1), &Task::file1, &Task::error1);
+        import(source2, &Task::file2, &Task::error2);
+        importing.join();
+
+        for (auto & task : tasks)
+            task.error = !task.error1.empty() ? task.error1 : task.error2;
+    }
+
+    // Files are compared in parallel, rather than the types of each file.
+    Comparison::Options file_options = options;
+    file_options.jobs = 1;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::atomic<size_t> next_task { 0 };
+
+    auto work = [&]()
+    {
+        size_t i;
+        while ((i = next_task++) < tasks.size())
+        {
+            auto & task = tasks[i];
+
+            if (task.error.empty())
+            {
+                try
+                {
+                    auto comparison = make_unique<Comparison>(file_options);
+                    comparison->compare(task.file1, task.file2);
+                    task.comparison = std::move(comparison);
+                }
+                catch (std::exception & e)
+                {
+                    task.error = e.what();
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            task.done = true;
+            changed.notify_all();
+        }
+    };
+
+    vector<std::thread> threads;
+    for (int i = 0; i < std::max(jobs, 1); ++i)
+        threads.emplace_back(work);
+
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        auto & task = tasks[i];
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]{ return task.done; });
+        }
+
+        report(common[i], task.comparison.get(), task.error);
+        task.comparison.reset();
+    }
+
+    for (auto & thread : threads)
+        thread.join();
+}
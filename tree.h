@@ -0,0 +1,47 @@
+#pragma once
+
+#include "comparison.h"
+
+#include <functional>
+#include <string>
+
+// Compares all .proto files under two root directories, pairing them by relative path.
+// Each root directory has one Source, so common imports are parsed only once.
+class Tree
+{
+public:
+    // Relative paths of all .proto files under the directory, in sorted order.
+    static vector<string> find_files(const string & root_dir);
+
+    // Files are found and read as of the git revisions, unless they are empty.
+    Tree(const string & root_dir1, const string & root_dir2,
+         const string & revision1 = string(), const string & revision2 = string());
+
+    // Files only under the first or only under the second root directory.
+    const vector<string> & removed_files() const { return removed; }
+    const vector<string> & added_files() const { return added; }
+    // Files under both root directories.
+    const vector<string> & common_files() const { return common; }
+
+    // Called with the comparison of a common file, or with a null comparison
+    // and the error message if either file failed to load.
+    using Report = std::function<void(const string & file, Comparison * comparison, const string & error)>;
+
+    // Imports all common files, then compares each pair in one of 'jobs' threads.
+    // Reports the results from the calling thread, in order of common files,
+    // and releases each comparison once reported.
+    void compare(const Comparison::Options & options, int jobs, const Report & report);
+
+    // Total time spent importing files, in seconds.
+    double load_time() const { return d_load_time; }
+
+private:
+    Source source1;
+    Source source2;
+
+    vector<string> removed;
+    vector<string> added;
+    vector<string> common;
+
+    double d_load_time = 0;
+};
@@ -0,0 +1,256 @@
+#include "watch.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <stdexcept>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace std;
+
+using google::protobuf::FileDescriptorProto;
+
+namespace {
+
+// Changes of files, and creation and removal of directories.
+constexpr uint32_t watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+// Editors may save a file in several steps, so changes are collected until none follow for this long.
+constexpr int settle_time = 20;
+
+bool is_proto_file(const string & name)
+{
+    const string extension = ".proto";
+    return name.size() > extension.size() and
+            name.compare(name.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+string join_path(const string & directory, const string & name)
+{
+    return directory.empty() ? name : directory + "/" + name;
+}
+
+bool is_under(const string & path, const string & directory)
+{
+    return path.compare(0, directory.size(), directory) == 0 and
+            (path.size() == directory.size() or path[directory.size()] == '/');
+}
+
+}
+
+Watch::Watch(const string & root_dir1, const string & file1, const string & revision1,
+             const string & root_dir2, const string & file2, const string & type,
+             const Comparison::Options & options):
+    root_dir2(root_dir2),
+    file_path2(file2),
+    type(type),
+    options(options),
+    source1(Source::at_revision(root_dir1, revision1))
+{
+    if (!filesystem::is_directory(root_dir2))
+        throw std::runtime_error("Not a directory: " + root_dir2);
+
+    this->file1 = source1.import(file1);
+    baseline = make_unique<Comparison::Baseline>(this->file1, options);
+}
+
+Watch::~Watch()
+{
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+}
+
+Comparison & Watch::update(const vector<string> & changed_files)
+{
+    // Files importing changed ones refer to their types by resolved names, so they are parsed again too.
+    vector<string> invalid = changed_files;
+    while (!invalid.empty())
+    {
+        string file = std::move(invalid.back());
+        invalid.pop_back();
+
+        if (parsed.erase(file))
+        {
+            auto found = importers.find(file);
+            if (found != importers.end())
+                invalid.insert(invalid.end(), found->second.begin(), found->second.end());
+        }
+    }
+
+    auto source = make_unique<Source>(root_dir2);
+    for (auto & [path, file] : parsed)
+        source->add_parsed(path, file);
+
+    auto * file2 = source->import(file_path2);
+
+    auto result = make_unique<Comparison>(options, baseline.get());
+    if (type == ".")
+        result->compare(file1, file2);
+    else
+        result->compare(source1, type, *source, type);
+
+    // Keep the files the second side imports, as they were built, for the next update.
+    unordered_map<string, FileDescriptorProto> built;
+    importers.clear();
+
+    vector<const FileDescriptor*> pending { file2 };
+    built[file2->name()];
+    while (!pending.empty())
+    {
+        auto * file = pending.back();
+        pending.pop_back();
+
+        auto & proto = built[file->name()];
+        auto found = parsed.find(file->name());
+        if (found != parsed.end())
+            proto.Swap(&found->second);
+        else
+            file->CopyTo(&proto);
+
+        for (int i = 0; i < file->dependency_count(); ++i)
+        {
+            auto * dependency = file->dependency(i);
+            importers[dependency->name()].push_back(file->name());
+            if (built.emplace(dependency->name(), FileDescriptorProto()).second)
+                pending.push_back(dependency);
+        }
+    }
+    parsed.swap(built);
+
+    comparison = std::move(result);
+    source2 = std::move(source);
+    return *comparison;
+}
+
+void Watch::start()
+{
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0)
+        throw std::runtime_error("Failed to watch directory: " + root_dir2);
+
+    vector<string> files;
+    add_watches("", files);
+}
+
+void Watch::add_watches(const string & directory, vector<string> & files)
+{
+    auto add_watch = [&](const string & path)
+    {
+        int wd = inotify_add_watch(inotify_fd, join_path(root_dir2, path).c_str(), watch_mask | IN_ONLYDIR);
+        if (wd >= 0)
+            directories[wd] = path;
+        return wd >= 0;
+    };
+
+    if (!add_watch(directory) and directory.empty())
+        throw std::runtime_error("Failed to watch directory: " + root_dir2);
+
+    // Subdirectories may be removed while they are listed.
+    std::error_code error;
+    filesystem::path root(join_path(root_dir2, directory));
+    for (filesystem::recursive_directory_iterator entry(root, error), end; !error and entry != end; entry.increment(error))
+    {
+        string path = join_path(directory, entry->path().lexically_relative(root).generic_string());
+        if (entry->is_directory(error))
+            add_watch(path);
+        else if (is_proto_file(path))
+            files.push_back(path);
+    }
+}
+
+void Watch::remove_watches(const string & directory)
+{
+    for (auto watch = directories.begin(); watch != directories.end(); )
+    {
+        if (is_under(watch->second, directory))
+        {
+            inotify_rm_watch(inotify_fd, watch->first);
+            watch = directories.erase(watch);
+        }
+        else
+        {
+            ++watch;
+        }
+    }
+}
+
+void Watch::add_parsed_under(const string & directory, vector<string> & files) const
+{
+    for (auto & entry : parsed)
+    {
+        if (is_under(entry.first, directory))
+            files.push_back(entry.first);
+    }
+}
+
+vector<string> Watch::wait(int timeout)
+{
+    vector<string> changed;
+
+    alignas(inotify_event) char buffer[64 * 1024];
+    pollfd descriptor { inotify_fd, POLLIN, 0 };
+
+    while (true)
+    {
+        int result = poll(&descriptor, 1, timeout);
+        if (result < 0 and errno == EINTR)
+            continue;
+        if (result < 0)
+            throw std::runtime_error("Failed to watch directory: " + root_dir2);
+        if (result == 0)
+            break;
+
+        ssize_t size = read(inotify_fd, buffer, sizeof(buffer));
+        if (size < 0 and errno == EINTR)
+            continue;
+        if (size <= 0)
+            throw std::runtime_error("Failed to watch directory: " + root_dir2);
+
+        for (char * position = buffer; position < buffer + size; )
+        {
+            auto * event = reinterpret_cast<inotify_event*>(position);
+            position += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                parsed.clear();
+                importers.clear();
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED)
+            {
+                directories.erase(event->wd);
+                continue;
+            }
+
+            auto directory = directories.find(event->wd);
+            if (directory == directories.end() or event->len == 0)
+                continue;
+
+            string path = join_path(directory->second, event->name);
+
+            // Files under a directory moved away or in, or replaced, are gone or new.
+            if (event->mask & IN_ISDIR)
+            {
+                add_parsed_under(path, changed);
+                if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                    remove_watches(path);
+                else
+                    add_watches(path, changed);
+            }
+            else if (is_proto_file(event->name) and !(event->mask & IN_CREATE))
+            {
+                changed.push_back(path);
+            }
+        }
+
+        timeout = settle_time;
+    }
+
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    return changed;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "comparison.h"
+
+#include <google/protobuf/descriptor.pb.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Compares a file with one in a directory each time .proto files under that directory change.
+// The first side and its fingerprints and sorted fields are loaded once. The second side is
+// built again from the files parsed before, and only changed files and those importing them
+// are parsed again.
+class Watch
+{
+public:
+    // The first side is read from root_dir1, as of the git revision if not empty.
+    // The second side is read from the directory root_dir2.
+    // The type is a message or enum name, or "." for all types of the files.
+    Watch(const string & root_dir1, const string & file1, const string & revision1,
+          const string & root_dir2, const string & file2, const string & type,
+          const Comparison::Options & options);
+    ~Watch();
+
+    // Loads the second side again, parsing the changed files, given relative to root_dir2,
+    // and the files importing them, and compares it. Throws if the second side fails to load.
+    // The comparison is valid until the next update.
+    Comparison & update(const vector<string> & changed_files);
+
+    // Starts watching root_dir2 and its subdirectories with inotify.
+    void start();
+
+    // Waits for changes of .proto files under root_dir2 until none follow for a moment,
+    // and returns their paths relative to it, in sorted order. Returns no paths if none
+    // changed within the timeout in milliseconds, unless it is negative, or if changes
+    // were lost, in which case the next update parses all files again.
+    vector<string> wait(int timeout = -1);
+
+private:
+    // Watches the directory, given relative to root_dir2, and its subdirectories.
+    // Adds the .proto files in them to the files.
+    void add_watches(const string & directory, vector<string> & files);
+
+    // Stops watching the directory and its subdirectories.
+    void remove_watches(const string & directory);
+
+    // Adds the parsed files under the directory to the files.
+    void add_parsed_under(const string & directory, vector<string> & files) const;
+
+    string root_dir2;
+    string file_path2;
+    string type;
+    Comparison::Options options;
+
+    Source source1;
+    const FileDescriptor * file1 = nullptr;
+    std::unique_ptr<Comparison::Baseline> baseline;
+
+    // Files of the second side as built last time, and the files importing each one.
+    unordered_map<string, google::protobuf::FileDescriptorProto> parsed;
+    unordered_map<string, vector<string>> importers;
+
+    // The comparison refers to names of the second side, so it is destroyed first.
+    std::unique_ptr<Source> source2;
+    std::unique_ptr<Comparison> comparison;
+
+    int inotify_fd = -1;
+    // Directories relative to root_dir2, by watch descriptor.
+    unordered_map<int, string> directories;
+};